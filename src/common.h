@@ -62,6 +62,18 @@ bool write_inputs(U8 *text, U32 *text_len, U32 *cursor);
 #define EDITOR_FOCUSED_PANEL_WEIGHT 1.5f
 #define EDITOR_SYNTAX_GROUP_SIZE 2
 
+// Memory for undo history per editor. The oldest history is dropped past it.
+#define UNDO_MEMORY_BUDGET (64ull*MB)
+
+// Files let go of stay loaded, up to this many and this much memory.
+#define BUFFER_CACHE_MAX_COUNT 16
+#define BUFFER_CACHE_BUDGET (2ull*GB)
+
+// Undo history is kept per file under $HOME, and restarted past this size.
+#define UNDO_HISTORY_DIR ".cache/edit/undo"
+#define UNDO_HISTORY_MAX_SIZE (256ull*MB)
+#define SAVE_IN_PLACE_MIN (64ull*MB)
+
 #define COLOUR_WHITE    { 200, 200, 200, 255 }
 #define COLOUR_RED      { 230, 100, 100, 255 }
 #define COLOUR_ORANGE   { 160, 100,  20, 255 }
@@ -86,15 +98,40 @@ bool write_inputs(U8 *text, U32 *text_len, U32 *cursor);
 
 #define MODE_INPUT_TEXT_MAX 512
 #define MODE_TEXT_MAX_LENGTH 8096
-#define TEXT_MAX_LENGTH (1ull << 32)
+#define TEXT_MAX_LENGTH (1ull << 38)
+#define TEXT_ADD_MAX_LENGTH (1ull << 32)
+#define TEXT_MAX_PIECE_SIZE (2ull*GB)
+#define TEXT_PIECE_MAX_LENGTH (16ull*KB)
+#define TEXT_MAX_PIECE_COUNT (TEXT_MAX_PIECE_SIZE / sizeof(Piece))
+#define TEXT_MAX_SLICE_COUNT (TEXT_MAX_LENGTH / TEXT_PIECE_MAX_LENGTH)
+#define LOAD_CHUNK_SIZE (4ull*MB)
+#define LOAD_MAX_CHUNK_COUNT (TEXT_MAX_LENGTH / LOAD_CHUNK_SIZE)
+#define LOAD_MAX_THREADS 64
+#define FOLLOW_READ_SIZE (16ull*MB)
+#define FOLLOW_MAX_ADD_LENGTH (TEXT_ADD_MAX_LENGTH / 2) // the rest is left for edits
+#define SAVE_WRITE_SIZE (8ull*MB)
+#define SAVE_HASH_STRIDE (64ull*MB)
+#define SAVE_MAX_HASH_MARK_COUNT (TEXT_MAX_LENGTH / SAVE_HASH_STRIDE + 1)
+#define RELOAD_DIFF_MAX_LENGTH (64ull*MB)
+#define RELOAD_DIFF_MAX_LINES (1ull*MB)
+#define RELOAD_DIFF_MAX_EDITS 2048
 #define SEARCH_MAX_LENGTH (256ull*MB)
+#define SEARCH_STEP_LENGTH (64ull*MB)
+#define REGEX_MAX_NFA_STATES (4*MODE_TEXT_MAX_LENGTH + 8)
+#define REGEX_MAX_DFA_STATES 4096
+#define REGEX_MAX_DFA_SET_LENGTH (4u*MB)
+#define REGEX_DFA_TABLE_SIZE (2*REGEX_MAX_DFA_STATES)
 #define PREV_SEARCH_BUFFER_MAX_LENGTH (256ull*MB)
 #define MAX_PREV_SEARCH_SIZE (256ull*MB)
-#define MAX_LINE_LOOKUP_SIZE (256ull*MB)
-#define MAX_SYNTAX_LOOKUP_SIZE (256ull*MB)
+#define MAX_SYNTAX_LOOKUP_SIZE (1ull*GB)
+#define SYNTAX_MAX_RANGE_COUNT (MAX_SYNTAX_LOOKUP_SIZE / sizeof(SyntaxRange))
 
 #define UNDO_STACK_SIZE (64ul*MB)
-#define UNDO_TEXT_SIZE (64ul*MB)
+#define UNDO_TEXT_SIZE (256ul*MB)
+#define UNDO_HOT_SIZE (4ul*MB)
+#define UNDO_BLOCK_SIZE (1ul*MB)
+#define UNDO_PACKED_SIZE (2*UNDO_MEMORY_BUDGET + UNDO_TEXT_SIZE)
+#define UNDO_MAX_BLOCK_COUNT (64ul*KB)
 #define UNDO_MAX (UNDO_STACK_SIZE / sizeof(UndoElem))
 
 #define EVENTS_MAX 128
@@ -0,0 +1,128 @@
+// DIFF ######################################################################
+
+typedef struct DiffLines {
+    U64 *starts; // count + 1, the last is the length
+    U64 *hashes;
+    U64 count;
+    const U8 *bytes;
+} DiffLines;
+
+static U64 diff_hash(const U8 *bytes, U64 length) {
+    U64 h = length * 0x9E3779B97F4A7C15ull;
+    for (; length >= 8; length -= 8, bytes += 8) {
+        U64 word;
+        memcpy(&word, bytes, sizeof(word));
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    U64 tail = 0;
+    memcpy(&tail, bytes, length);
+    h = (h ^ tail) * 0xFF51AFD7ED558CCDull;
+    return h ^ (h >> 32);
+}
+
+// a line ends after its newline, the last one may have none
+static DiffLines diff_split(Arena *arena, const U8 *bytes, U64 length) {
+    DiffLines lines = { .bytes = bytes };
+    lines.count = scan_count_newlines(bytes, length) + (length && bytes[length-1] != '\n');
+    lines.starts = ARENA_ALLOC_ARRAY(arena, U64, lines.count + 1);
+    lines.hashes = ARENA_ALLOC_ARRAY(arena, U64, lines.count);
+
+    U64 at = 0;
+    for (U64 i = 0; i < lines.count; ++i) {
+        const U8 *newline = memchr(bytes + at, '\n', length - at);
+        U64 end = newline ? (U64)(newline - bytes) + 1 : length;
+        lines.starts[i] = at;
+        lines.hashes[i] = diff_hash(bytes + at, end - at);
+        at = end;
+    }
+    lines.starts[lines.count] = length;
+    return lines;
+}
+
+static bool diff_equal(DiffLines *a, U64 i, DiffLines *b, U64 j) {
+    if (a->hashes[i] != b->hashes[j]) return false;
+    U64 length = a->starts[i+1] - a->starts[i];
+    if (length != b->starts[j+1] - b->starts[j]) return false;
+    return memcmp(a->bytes + a->starts[i], b->bytes + b->starts[j], length) == 0;
+}
+
+// Returns the number of hunks turning `a` into `b`, in order, or -1 if that
+// takes more than `max_edits` lines inserted and removed.
+I64 diff_lines(Arena *arena, const U8 *a, U64 a_length, const U8 *b, U64 b_length, U32 max_edits, DiffHunk **hunks) { TRACE
+    DiffLines la = diff_split(arena, a, a_length);
+    DiffLines lb = diff_split(arena, b, b_length);
+    I64 n = (I64)la.count;
+    I64 m = (I64)lb.count;
+
+    // furthest x reached on each diagonal k = x - y, and its values after
+    // every step d for going back, at trace[d][d + k]
+    I64 max = max_edits;
+    I64 *v_base = ARENA_ALLOC_ARRAY(arena, I64, 2 * (U64)max + 3);
+    I64 *v = v_base + max + 1;
+    I64 **trace = ARENA_ALLOC_ARRAY(arena, I64 *, (U64)max + 1);
+    v[1] = 0;
+
+    I64 d = 0;
+    bool found = false;
+    for (; d <= max && !found; ++d) {
+        I64 *row = ARENA_ALLOC_ARRAY(arena, I64, 2 * (U64)d + 1);
+        trace[d] = row + d;
+        for (I64 k = -d; k <= d; k += 2) {
+            I64 x = (k == -d || (k != d && v[k-1] < v[k+1])) ? v[k+1] : v[k-1] + 1;
+            I64 y = x - k;
+            while (x < n && y < m && diff_equal(&la, (U64)x, &lb, (U64)y)) {
+                x++;
+                y++;
+            }
+            v[k] = x;
+            trace[d][k] = x;
+            if (x >= n && y >= m) found = true;
+        }
+    }
+    if (!found) return -1;
+    d--;
+
+    // walk the edits back from the end, one per step
+    DiffHunk *out = ARENA_ALLOC_ARRAY(arena, DiffHunk, (U64)d);
+    I64 hunk_count = 0;
+    I64 x = n;
+    I64 y = m;
+    for (; d > 0; --d) {
+        I64 k = x - y;
+        I64 *prev = trace[d-1];
+        bool down = k == -d || (k != d && prev[k-1] < prev[k+1]);
+        I64 prev_k = down ? k + 1 : k - 1;
+        I64 prev_x = prev[prev_k];
+        I64 prev_y = prev_x - prev_k;
+
+        // the edit, after the matching lines that led up to (x, y)
+        I64 edit_x = down ? prev_x : prev_x + 1;
+        I64 edit_y = down ? prev_y + 1 : prev_y;
+        DiffHunk *last = hunk_count ? &out[hunk_count-1] : NULL;
+        if (last && last->a_start == (U64)edit_x && last->b_start == (U64)edit_y) {
+            last->a_start = (U64)prev_x;
+            last->b_start = (U64)prev_y;
+        } else {
+            out[hunk_count++] = (DiffHunk) { (U64)prev_x, (U64)edit_x, (U64)prev_y, (U64)edit_y };
+        }
+        x = prev_x;
+        y = prev_y;
+    }
+
+    // back into order, and lines into bytes
+    for (I64 i = 0; i < hunk_count / 2; ++i) {
+        DiffHunk temp = out[i];
+        out[i] = out[hunk_count-1-i];
+        out[hunk_count-1-i] = temp;
+    }
+    for (I64 i = 0; i < hunk_count; ++i) {
+        out[i].a_start = la.starts[out[i].a_start];
+        out[i].a_end = la.starts[out[i].a_end];
+        out[i].b_start = lb.starts[out[i].b_start];
+        out[i].b_end = lb.starts[out[i].b_end];
+    }
+
+    *hunks = out;
+    return hunk_count;
+}
@@ -0,0 +1,18 @@
+#ifndef DIFF_H_
+#define DIFF_H_
+
+// A line diff with the greedy algorithm of Myers, which takes O((N+M)D) for
+// N and M lines and D lines inserted or removed. Lines are compared by hash
+// first, and it gives up past a number of edits, as by then replacing
+// everything from the first change to the last is about as good.
+
+// lines of `a` in [a_start, a_end) are replaced by those of `b` in
+// [b_start, b_end), as byte offsets
+typedef struct DiffHunk {
+    U64 a_start, a_end;
+    U64 b_start, b_end;
+} DiffHunk;
+
+I64 diff_lines(Arena *arena, const U8 *a, U64 a_length, const U8 *b, U64 b_length, U32 max_edits, DiffHunk **hunks);
+
+#endif
@@ -4,17 +4,40 @@ typedef struct Indices {
 } Indices;
 
 typedef struct Insertion {
+    I64 at;
     U64 text_len;
     U8 *text;
 } Insertion;
 
 UndoStack   undo_create(Arena *arena);
 void        undo_clear(UndoStack *st);
-UndoElem   *undo_record(UndoStack *st, I64 at, U8 *text, I64 text_length, UndoOp op);
+void        undo_group_begin(UndoStack *st);
+void        undo_group_end(UndoStack *st);
+U8         *undo_record(UndoStack *st, I64 at, I64 text_length, UndoOp op);
+bool        undo_history_exists(const char *path, U64 content_length);
+void        undo_history_open(UndoStack *st, const char *path, U64 content_hash, U64 content_length);
+int         undo_history_write(UndoStack *st, const char *path, U64 content_hash, U64 content_length);
+void        undo_history_close(UndoStack *st);
+static U64  undo_memory(UndoStack *st);
+static void undo_hash_update(UndoHash *hs, const U8 *bytes, U64 length);
+static U64  undo_hash_final(UndoHash *hs);
 
 void        editor_on_focus(Panel *ed_panel);
 void        editor_on_focus_lost(Panel *ed_panel);
-void        editor_clear_file(Editor *ed);
+static Buffer *buffer_create(void);
+static void buffer_release(Buffer *buf);
+static Buffer *buffer_find(const char *real_path);
+static void buffer_list(Buffer *buf);
+static void buffer_unlist(Buffer *buf);
+static void buffer_stat_file(Buffer *buf);
+static bool buffer_file_changed(Buffer *buf);
+static void buffer_watch(Buffer *buf);
+static void buffer_unwatch(Buffer *buf);
+static void buffer_watch_poll(void);
+static void editor_attach_buffer(Editor *ed, Buffer *buf);
+static void editor_release_buffer(Editor *ed);
+static void editor_reopen(Editor *ed);
+static void editor_reload_poll(Editor *ed);
 Range       editor_group(Editor *ed, Group group, I64 byte);
 Range       editor_group_next(Editor *ed, Group group, I64 current_group_end);
 Range       editor_group_prev(Editor *ed, Group group, I64 current_group_start);
@@ -30,19 +53,51 @@ void        editor_set_selection(Editor *ed, I64 base, I64 head);
 
 void        editor_undo(Editor *ed);
 void        editor_redo(Editor *ed);
+static void editor_insert_start(Editor *ed, I64 cursor);
+static void editor_insert_sync(Editor *ed);
+static void editor_insert_end(Buffer *buf);
+static void editor_insert_yield(Editor *ed);
 static inline U8 editor_text(Editor *ed, I64 byte);
+static U32  editor_codepoint(Editor *ed, I64 byte, I64 *end);
+static I64  editor_char_end(Editor *ed, I64 byte);
+static I64  editor_char_start(Editor *ed, I64 byte);
+static I64  editor_char_advance(Editor *ed, I64 byte, I64 count, I64 limit);
+static I64  editor_char_count(Editor *ed, I64 start, I64 end);
+static inline SyntaxRange editor_syntax_range(Editor *ed, U32 idx);
+static U32  editor_syntax_range_find(Editor *ed, I64 byte);
+static I64  editor_search_match_find(Editor *ed, I64 byte);
+static Range editor_search_match(Editor *ed, I64 i);
+static bool editor_search_scanning(Editor *ed);
 void        editor_open_filetree(Panel *ed_panel, bool expand);
 void        editor_open_jumplist(Panel *ed_panel);
 void        editor_jumplist_add(Panel *ed_panel, JumpPoint point);
 void        editor_text_remove(Editor *ed, I64 start, I64 end);
 void        editor_text_insert(Editor *ed, I64 at, U8 *text, I64 length);
-// void        editor_text_remove_bulk(Editor *ed, Range *ranges, U64 remove_count);
-// void        editor_text_insert_bulk(Editor *ed, Insertion *insertions, U64 insert_count);
+void        editor_text_remove_bulk(Editor *ed, Range *ranges, U64 remove_count);
+void        editor_text_insert_bulk(Editor *ed, Insertion *insertions, U64 insert_count);
+void        editor_text_replace_bulk(Editor *ed, Range *ranges, U64 range_count, U8 *text, I64 length);
 // same as above, but does not add to the undo stack
 void        editor_text_remove_raw(Editor *ed, I64 start, I64 end);
 void        editor_text_insert_raw(Editor *ed, I64 at, U8 *text, I64 length);
 
 void        editor_remake_caches(Editor *ed);
+static void editor_history_path(Editor *ed);
+static void editor_history_open(Editor *ed, UndoHash *hs, U64 content_length);
+static void editor_history_save(Editor *ed, U64 content_hash, U64 content_length);
+void        editor_load_wait(Editor *ed, I64 line);
+static void editor_load_start(Editor *ed);
+static void editor_stream_start(Editor *ed, int fd);
+static void editor_load_stop(EditorLoader *ld);
+static void editor_load_finish(Editor *ed);
+static void editor_load_poll(Editor *ed);
+static void editor_save_start(Editor *ed);
+static void editor_save_join(EditorSaver *sv);
+static void editor_save_poll(Editor *ed);
+static void editor_follow_start(Editor *ed);
+static void editor_follow_stop(EditorFollow *fl);
+static void editor_follow_poll(Editor *ed);
+static I64  editor_syntax_begin_edit(Editor *ed, I64 byte);
+static void editor_syntax_lex(Editor *ed, I64 start, I64 end);
 
 static U64 int_to_string(Arena *arena, I64 n);
 
@@ -164,25 +219,26 @@ SyntaxHighlighting *syntax_for_path(const U8 *filepath, U32 filepath_len) {
 Panel *editor_create(UI *ui, const U8 *filepath) { TRACE
     Panel *panel = panel_create(ui);
     panel->update_fn = editor_update;
+    panel->destroy_fn = editor_destroy;
     panel->focus_fn = editor_on_focus;
     panel->focus_lost_fn = editor_on_focus_lost;
     Arena *arena = panel_arena(panel);
 
     Editor *ed = arena_alloc(arena, sizeof(Editor), alignof(Editor));
     *ed = (Editor) {
-        .undo_stack = undo_create(arena),
         .selection_group = Group_Line,
         .mode_text = arena_alloc(arena, MODE_TEXT_MAX_LENGTH, 16),
         .mode_text_alt = arena_alloc(arena, MODE_TEXT_MAX_LENGTH, 16),
-        .text = arena_alloc(arena, TEXT_MAX_LENGTH, page_size()),
         .search_matches = arena_alloc(arena, SEARCH_MAX_LENGTH, page_size()),
-        .line_lookup = arena_alloc(arena, MAX_LINE_LOOKUP_SIZE, page_size()),
-        .syntax_lookup = arena_alloc(arena, MAX_SYNTAX_LOOKUP_SIZE, page_size()),
-        
+        .search_match_ends = arena_alloc(arena, SEARCH_MAX_LENGTH, page_size()),
+        .search_regex = regex_create(arena),
+        .search_query = arena_alloc(arena, MODE_TEXT_MAX_LENGTH, 16),
+        .search_query_length = -1,
         .prev_search_buffer = arena_alloc(arena, PREV_SEARCH_BUFFER_MAX_LENGTH, page_size()),
         .prev_searches = arena_alloc(arena, MAX_PREV_SEARCH_SIZE, page_size()),
     };
     ed->arena = arena;
+    editor_attach_buffer(ed, buffer_create());
     panel->data = ed;
     panel->name = "editor";
     
@@ -192,6 +248,11 @@ Panel *editor_create(UI *ui, const U8 *filepath) { TRACE
     return panel;
 }
 
+void editor_destroy(Panel *panel) { TRACE
+    Editor *ed = panel->data;
+    editor_release_buffer(ed);
+}
+
 void editor_group_expand(Editor *ed) { TRACE
     static const Group lut[Group_Count] = {
        Group_Paragraph, // Group_Paragraph
@@ -220,6 +281,11 @@ void editor_on_focus(Panel *ed_panel) {
 
 void editor_on_focus_lost(Panel *ed_panel) {
     ed_panel->dynamic_weight_w = 1.f;
+
+    // edits made while away don't belong to the insert session
+    Editor *ed = ed_panel->data;
+    if (ed->buf && ed->buf->insert_view == ed)
+        editor_insert_end(ed->buf);
 }
 
 void editor_copy_to_search_buffer(Editor *ed, PrevSearch *prev_search) { TRACE
@@ -277,26 +343,290 @@ void editor_process_search_history(Editor *ed) { TRACE
     }
 }
 
-void editor_search(Editor *ed) { TRACE
-    ed->search_match_count = 0;
-    if (ed->mode_text_length > 0) {
-        I64 start = ed->search_a;
-        I64 end = ed->search_b - ed->mode_text_length;
-        for (I64 a = start; a < end; ++a) {
-            bool matches = true;
-            for (I64 i = 0; i < ed->mode_text_length; ++i) {
-                U8 search_char = ed->mode_text[i];
-                U8 text_char = ed->text[a+i];
-                if (search_char != text_char) {
-                    matches = false; 
-                    break;
+// Returns the first occurrence of needle starting in [a, end), or end.
+// Occurrences inside a chunk are found with scan_find_string, the few starting
+// too close to the end of a chunk are compared across it byte by byte.
+static I64 editor_search_find(Editor *ed, I64 a, I64 end, const U8 *needle, I64 needle_length) {
+    while (a < end) {
+        TextChunk chunk = text_chunk(&ed->buf->text, a);
+        I64 chunk_end = chunk.start + chunk.length;
+        I64 inside_end = chunk_end - needle_length + 1;
+
+        I64 scan_end = inside_end < end ? inside_end : end;
+        if (a < scan_end) {
+            U64 length = (U64)(scan_end - a + needle_length - 1);
+            U64 found = scan_find_string(chunk.ptr + (a - chunk.start), length, needle, (U64)needle_length);
+            if (found != length) return a + (I64)found;
+            a = scan_end;
+        }
+
+        I64 across_end = chunk_end < end ? chunk_end : end;
+        for (; a < across_end; ++a) {
+            I64 i = 0;
+            while (i < needle_length && editor_text(ed, a+i) == needle[i])
+                i++;
+            if (i == needle_length)
+                return a;
+        }
+        a = chunk_end;
+    }
+    return end;
+}
+
+// Finds matches starting in [a, end), returning where it stopped.
+static I64 editor_search_scan(Editor *ed, I64 a, I64 end) {
+    I64 max_count = (I64)(SEARCH_MAX_LENGTH / sizeof(I64));
+    while (a < end && ed->search_match_count < max_count) {
+        a = editor_search_find(ed, a, end, ed->mode_text, ed->mode_text_length);
+        if (a < end)
+            ed->search_matches[ed->search_match_count++] = a++;
+    }
+
+    // a full match array ends the search
+    if (ed->search_match_count == max_count) return end;
+    return a < end ? a : end;
+}
+
+// Returns the end of the longest regex match starting at `start`, or -1.
+static I64 editor_regex_longest(Editor *ed, I64 start, I64 limit) {
+    Regex *re = &ed->search_regex;
+    RegexDfa *dfa = &re->anchored;
+    Text *t = &ed->buf->text;
+
+    bool line_start = start == 0 || text_byte(t, start-1) == '\n';
+    U32 state = regex_start(re, dfa, line_start);
+    I64 longest = -1;
+    for (I64 i = start; i < limit && state != REGEX_DEAD;) {
+        state = regex_next(re, dfa, state, text_byte(t, i++));
+        I32 next = i < t->length ? text_byte(t, i) : -1;
+        if (regex_accepts(dfa, state, next))
+            longest = i;
+    }
+    return longest;
+}
+
+// Runs the unanchored regex DFA from `a` to where the first match ends.
+// Returns false if there is none, setting *at to where that became certain:
+// past `end` with no match under way, or at `limit`. While no match is under
+// way it skips to the next byte that can start one with scan_find.
+static bool editor_regex_first_end(Editor *ed, I64 a, I64 end, I64 limit, I64 *at) {
+    Regex *re = &ed->search_regex;
+    RegexDfa *dfa = &re->unanchored;
+    Text *t = &ed->buf->text;
+
+    U32 state = regex_start(re, dfa, a == 0 || text_byte(t, a-1) == '\n');
+    bool skipped = false;
+    while (a < limit) {
+        TextChunk chunk = text_chunk(t, a);
+        const U8 *ptr = chunk.ptr + (a - chunk.start);
+        I64 chunk_end = chunk.start + chunk.length;
+        I64 n = (chunk_end < limit ? chunk_end : limit) - a;
+
+        for (I64 i = 0; i < n; ++i) {
+            if (dfa->states[state].flags & REGEX_FLAG_IDLE) {
+                if (a + i >= end) {
+                    *at = a + i;
+                    return false;
+                }
+                I64 skip = (I64)scan_find(&re->first, ptr + i, (U64)(n - i));
+                if (skip > 0) {
+                    skipped = true;
+                    i += skip;
+                    if (i == n) break;
+                }
+                if (skipped) {
+                    U8 prev = i > 0 ? ptr[i-1] : text_byte(t, a + i - 1);
+                    state = regex_start(re, dfa, prev == '\n');
+                    skipped = false;
+                }
+            }
+
+            state = regex_next(re, dfa, state, ptr[i]);
+            if (dfa->states[state].flags & (REGEX_FLAG_MATCH | REGEX_FLAG_MATCH_AT_LINE_END)) {
+                I64 pos = a + i + 1;
+                I32 next = pos < t->length ? text_byte(t, pos) : -1;
+                if (regex_accepts(dfa, state, next)) {
+                    *at = pos;
+                    return true;
                 }
             }
+        }
+        a += n;
+    }
+    *at = limit;
+    return false;
+}
+
+// Finds the leftmost longest regex matches starting in [a, end), without
+// overlaps, returning where the next scan starts. Matches may run on to
+// search_b. The unanchored DFA finds where the next match ends, so text
+// without matches is read once, then only the starts up to there are tried.
+// Patterns that can match nothing try every start, empty matches are skipped.
+static I64 editor_search_regex_scan(Editor *ed, I64 a, I64 end) {
+    Regex *re = &ed->search_regex;
+    I64 max_count = (I64)(SEARCH_MAX_LENGTH / sizeof(I64));
+    I64 limit = clamp(ed->search_b, 0, ed->buf->text.length);
+
+    while (a < end && ed->search_match_count < max_count) {
+        I64 last_start = end - 1;
+        if (!re->empty) {
+            if (re->prefix_length > 0) {
+                a = editor_search_find(ed, a, limit, re->prefix, re->prefix_length);
+                if (a >= end) return a;
+            }
+
+            I64 first_end;
+            if (!editor_regex_first_end(ed, a, end, limit, &first_end))
+                return first_end;
+            if (first_end < last_start)
+                last_start = first_end;
+        }
+
+        I64 start = a;
+        I64 match_end = -1;
+        for (; start <= last_start; ++start) {
+            match_end = editor_regex_longest(ed, start, limit);
+            if (match_end > start) break;
+        }
+        if (start > last_start) {
+            a = start;
+            continue;
+        }
+
+        ed->search_matches[ed->search_match_count] = start;
+        ed->search_match_ends[ed->search_match_count] = match_end;
+        ed->search_match_count++;
+        a = match_end;
+    }
+
+    // a full match array ends the search
+    if (ed->search_match_count == max_count) return end;
+    return a;
+}
+
+// Drops the matches that a query extending the previous one no longer matches.
+static void editor_search_narrow(Editor *ed) {
+    I64 prefix_length = ed->search_query_length;
+    I64 end = ed->search_b - ed->mode_text_length;
+    I64 kept = 0;
+    for (I64 m = 0; m < ed->search_match_count; ++m) {
+        I64 at = ed->search_matches[m];
+        if (at >= end) break;
+
+        I64 i = prefix_length;
+        while (i < ed->mode_text_length && editor_text(ed, at+i) == ed->mode_text[i])
+            i++;
+        if (i == ed->mode_text_length)
+            ed->search_matches[kept++] = at;
+    }
+    ed->search_match_count = kept;
+}
+
+// matches start before this
+static I64 editor_search_end(Editor *ed) {
+    I64 end = ed->search_regex_mode ? ed->search_b : ed->search_b - ed->mode_text_length;
+    return clamp(end, 0, ed->buf->text.length);
+}
 
-            if (matches)
-                ed->search_matches[ed->search_match_count++] = a;
+// Finds matches of mode_text starting in [search_a, search_b - length),
+// or of the regex in it when search_regex_mode is set.
+// Called every frame: the matches are kept while nothing changes, a longer
+// query filters them instead of searching again, and a search over a lot of
+// text is spread over frames SEARCH_STEP_LENGTH bytes at a time.
+void editor_search(Editor *ed) { TRACE
+    I64 length = ed->mode_text_length;
+    bool regex = ed->search_regex_mode;
+    bool same_scope = ed->search_version == ed->buf->text.version
+        && ed->search_query_a == ed->search_a
+        && ed->search_query_b == ed->search_b
+        && ed->search_query_regex == regex;
+    bool same_query = ed->search_query_length == length
+        && memcmp(ed->search_query, ed->mode_text, (U64)length) == 0;
+
+    if (!same_scope || !same_query) {
+        bool narrows = same_scope
+            && !regex
+            && ed->search_query_length > 0
+            && ed->search_query_length < length
+            && memcmp(ed->search_query, ed->mode_text, (U64)ed->search_query_length) == 0;
+
+        // matches before search_scanned are narrowed, the scan goes on after it
+        if (narrows) {
+            editor_search_narrow(ed);
+        } else {
+            ed->search_match_count = 0;
+            ed->search_scanned = clamp(ed->search_a, 0, ed->buf->text.length);
         }
+
+        memcpy(ed->search_query, ed->mode_text, (U64)length);
+        ed->search_query_length = length;
+        ed->search_query_a = ed->search_a;
+        ed->search_query_b = ed->search_b;
+        ed->search_version = ed->buf->text.version;
+        ed->search_query_regex = regex;
+        if (regex && length > 0)
+            ed->search_regex_valid = regex_compile(&ed->search_regex, ed->mode_text, (U64)length);
+    }
+
+    if (length == 0 || (regex && !ed->search_regex_valid)) {
+        ed->search_match_count = 0;
+        return;
+    }
+
+    I64 end = editor_search_end(ed);
+    if (ed->search_scanned < end) {
+        I64 step_end = ed->search_scanned + (I64)SEARCH_STEP_LENGTH;
+        if (step_end > end) step_end = end;
+        if (regex)
+            ed->search_scanned = editor_search_regex_scan(ed, ed->search_scanned, step_end);
+        else
+            ed->search_scanned = editor_search_scan(ed, ed->search_scanned, step_end);
+        if (ed->search_scanned < end)
+            w->force_update = true;
+    }
+}
+
+// true while editor_search has text left to scan
+static bool editor_search_scanning(Editor *ed) {
+    if (ed->search_regex_mode && !ed->search_regex_valid) return false;
+    return ed->mode_text_length > 0 && ed->search_scanned < editor_search_end(ed);
+}
+
+// the bytes search match `i` covers
+static Range editor_search_match(Editor *ed, I64 i) {
+    I64 start = ed->search_matches[i];
+    if (ed->search_regex_mode)
+        return (Range) { start, ed->search_match_ends[i] };
+    return (Range) { start, start + ed->mode_text_length };
+}
+
+// returns the index of the first search match at or after `byte`
+static I64 editor_search_match_find(Editor *ed, I64 byte) {
+    I64 low = 0;
+    I64 high = ed->search_match_count;
+    while (low < high) {
+        I64 mid = low + (high - low) / 2;
+        if (ed->search_matches[mid] < byte)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Appends the clipboard to a prompt, as much of it as fits in whole codepoints.
+void editor_mode_text_paste(U8 *buf, I64 *length) {
+    const U8 *text = (const U8*) glfwGetClipboardString(NULL);
+    if (text == NULL) return;
+    U64 len = my_strlen(text);
+    U64 space = MODE_TEXT_MAX_LENGTH - (U64)*length;
+    if (len > space) {
+        len = space;
+        while (len > 0 && utf8_continuation(text[len]))
+            len--;
     }
+    memcpy(&buf[*length], text, len);
+    *length += (I64)len;
 }
 
 void editor_ctrl_backspace(U8 *buf, I64 *length) {
@@ -346,6 +676,14 @@ void editor_update(Panel *panel) { TRACE
     FontAtlas *font_atlas = ui->atlas;
     
     // UPDATE ---------------------------------------------------------------
+
+    editor_load_poll(ed);
+    editor_save_poll(ed);
+    buffer_watch_poll();
+    editor_reload_poll(ed);
+    if (ed->buf->loader.running || ed->buf->saver.running)
+        w->force_update = true;
+    editor_follow_poll(ed);
     
     // state switch
     if (panel->flags & PanelFlag_Focused) {
@@ -359,6 +697,8 @@ void editor_update(Panel *panel) { TRACE
         bool ctrl = is(modifiers, GLFW_MOD_CONTROL);
         bool shift = is(modifiers, GLFW_MOD_SHIFT);
 
+        editor_insert_sync(ed);
+
         switch (ed->mode) {
         case Mode_Normal: {
             if (!ctrl && !shift && is(pressed | repeating, key_mask(GLFW_KEY_U)))
@@ -371,18 +711,24 @@ void editor_update(Panel *panel) { TRACE
                 // TODO run command
             }
 
+            if (!ctrl && shift && is(pressed, key_mask(GLFW_KEY_G))) {
+                if (ed->buf->follow.fd < 0)
+                    editor_follow_start(ed);
+                else
+                    editor_follow_stop(&ed->buf->follow);
+            }
+
             if (!ctrl && !shift && is(pressed, key_mask(GLFW_KEY_H)))
                 editor_group_expand(ed);
 
             if (!ctrl && !shift && is(pressed, key_mask(GLFW_KEY_L)))
                 editor_group_contract(ed);
 
+            // changed on disk since, shift to write over it
             if (ctrl && is(pressed, key_mask(GLFW_KEY_S))) {
-                if (ed->filepath && (ed->flags & EditorFlag_Unsaved) != 0) {
-                    expect(ed->text_length >= 0);
-                    expect(write_file((char*)ed->filepath, ed->text, (U64)ed->text_length) == 0);
-                    ed->flags &= ~(U32)EditorFlag_Unsaved;
-                }
+                bool conflict = ed->buf->disk_conflict && !shift;
+                if (ed->buf->filepath && (ed->buf->flags & EditorFlag_Unsaved) != 0 && !conflict)
+                    editor_save_start(ed);
             }
 
             if (is(pressed | repeating, key_mask(GLFW_KEY_J))) {
@@ -408,23 +754,20 @@ void editor_update(Panel *panel) { TRACE
             if (is(pressed, key_mask(GLFW_KEY_C))) {
                 if (shift)
                     editor_selection_trim(ed);
-                ed->mode = Mode_Insert;
-                ed->insert_cursor = ed->selection_a;
+                editor_insert_start(ed, ed->selection_a);
                 editor_text_remove(ed, ed->selection_a, ed->selection_b);
             }
 
             if (is(pressed, key_mask(GLFW_KEY_I))) {
                 if (shift)
                     editor_selection_trim(ed);
-                ed->mode = Mode_Insert;
-                ed->insert_cursor = ed->selection_a;
+                editor_insert_start(ed, ed->selection_a);
             }
 
             if (is(pressed, key_mask(GLFW_KEY_A))) {
                 if (shift)
                     editor_selection_trim(ed);
-                ed->mode = Mode_Insert;
-                ed->insert_cursor = ed->selection_b;
+                editor_insert_start(ed, ed->selection_b);
             }
 
             if (!ctrl && is(pressed, key_mask(GLFW_KEY_M))) {
@@ -458,13 +801,13 @@ void editor_update(Panel *panel) { TRACE
             }
 
             if (is(pressed, key_mask(GLFW_KEY_Y))) {
-                I64 copy_start = clamp(ed->selection_a, 0, ed->text_length);
-                I64 copy_end = clamp(ed->selection_b, 0, ed->text_length);
+                I64 copy_start = clamp(ed->selection_a, 0, ed->buf->text.length);
+                I64 copy_end = clamp(ed->selection_b, 0, ed->buf->text.length);
                 I64 copy_length_signed = copy_end - copy_start;
                 if (copy_length_signed > 0) {
-                    U32 copy_length = (U32)copy_length_signed;
+                    U64 copy_length = (U64)copy_length_signed;
                     char *copied = arena_alloc(&w->frame_arena, copy_length+1, 1);
-                    memcpy(copied, &ed->text[copy_start], copy_length);
+                    text_copy(&ed->buf->text, (U8*)copied, copy_start, copy_end);
                     copied[copy_length] = 0;
                     glfwSetClipboardString(NULL, copied);
                 }
@@ -472,7 +815,7 @@ void editor_update(Panel *panel) { TRACE
 
             if (is(pressed, key_mask(GLFW_KEY_F))) {
                 if (!ctrl)
-                    editor_set_selection(ed, ed->selection_a, ed->text_length);
+                    editor_set_selection(ed, ed->selection_a, ed->buf->text.length);
                 if (!shift)
                     editor_set_selection(ed, 0, ed->selection_b);
             }
@@ -494,7 +837,7 @@ void editor_update(Panel *panel) { TRACE
                 
                 if (!shift) {
                     ed->search_a = 0;
-                    ed->search_b = ed->text_length;
+                    ed->search_b = ed->buf->text.length;
                 } else {
                     ed->search_a = ed->selection_a;
                     ed->search_b = ed->selection_b;
@@ -521,7 +864,7 @@ void editor_update(Panel *panel) { TRACE
                 } else {
                     Range para = editor_group(ed, Group_Paragraph, ed->selection_a);
                     if (para.start < 0) para.start = 0;
-                    if (para.end > ed->text_length) para.end = ed->text_length;
+                    if (para.end > ed->buf->text.length) para.end = ed->buf->text.length;
                     if (para.end < para.start) {
                         I64 end = para.end;
                         para.end = para.start;
@@ -530,11 +873,14 @@ void editor_update(Panel *panel) { TRACE
                     
                     while (para.start < para.end && char_whitespace(editor_text(ed, para.end-1)))
                         para.end--;
+
+                    U8 *para_text = ARENA_ALLOC_ARRAY(&w->frame_arena, U8, (U64)(para.end - para.start));
+                    text_copy(&ed->buf->text, para_text, para.start, para.end);
                      
                     JumpPoint current_point = {
-                        .filepath = ed->filepath,
-                        .filepath_len = ed->filepath_length,
-                        .text = &ed->text[para.start],
+                        .filepath = ed->buf->filepath,
+                        .filepath_len = ed->buf->filepath_length,
+                        .text = para_text,
                         .text_len = (U32)(para.end - para.start),
                         .line_idx = editor_line_index(ed, ed->selection_a), 
                     };
@@ -551,15 +897,17 @@ void editor_update(Panel *panel) { TRACE
                 ed->mode = Mode_QuickMove;
 
             if (!ctrl && is(pressed, key_mask(GLFW_KEY_Q))) {
-                if ((ed->flags & EditorFlag_Unsaved) == 0 || shift)
+                if ((ed->buf->flags & EditorFlag_Unsaved) == 0 || shift)
                     panel_destroy_queued(panel);
             }
             
             // '<' - dedent selected lines 
             if (!ctrl && shift && is(pressed, key_mask(GLFW_KEY_COMMA))) {
                 Indices lines = editor_find_lines(ed, &w->frame_arena, ed->selection_a, ed->selection_b);
-                for (U64 i = lines.count; i > 0; --i) {
-                    I64 line_start = lines.ptr[i-1];
+                Range *ranges = ARENA_ALLOC_ARRAY(&w->frame_arena, Range, lines.count);
+                U64 range_count = 0;
+                for (U64 i = 0; i < lines.count; ++i) {
+                    I64 line_start = lines.ptr[i];
                     I64 text_start = line_start;
                     while (editor_text(ed, text_start) == ' ')
                         text_start++;
@@ -568,9 +916,10 @@ void editor_update(Panel *panel) { TRACE
                         I64 spaces_to_rm = 1;
                         while (((text_start - line_start - spaces_to_rm) & 3) != 0)
                             spaces_to_rm++;
-                        editor_text_remove(ed, line_start, line_start+spaces_to_rm);
+                        ranges[range_count++] = (Range) { line_start, line_start+spaces_to_rm };
                     }
                 }
+                editor_text_remove_bulk(ed, ranges, range_count);
             }
             
             // '>' - indent selected lines 
@@ -579,8 +928,9 @@ void editor_update(Panel *panel) { TRACE
                 memset(spaces, ' ', 4);
                 
                 Indices lines = editor_find_lines(ed, &w->frame_arena, ed->selection_a, ed->selection_b);
-                for (U64 i = lines.count; i > 0; --i) {
-                    I64 line_start = lines.ptr[i-1];
+                Insertion *insertions = ARENA_ALLOC_ARRAY(&w->frame_arena, Insertion, lines.count);
+                for (U64 i = 0; i < lines.count; ++i) {
+                    I64 line_start = lines.ptr[i];
                     I64 text_start = line_start;
                     while (editor_text(ed, text_start) == ' ')
                         text_start++;
@@ -589,8 +939,9 @@ void editor_update(Panel *panel) { TRACE
                     while (((text_start - line_start + spaces_to_add) & 3) != 0)
                         spaces_to_add++;
                     expect(spaces_to_add <= 4);
-                    editor_text_insert(ed, line_start, spaces, spaces_to_add);
+                    insertions[i] = (Insertion) { line_start, (U64)spaces_to_add, spaces };
                 }
+                editor_text_insert_bulk(ed, insertions, lines.count);
             }
             
             // 'v' - comment lines
@@ -618,34 +969,29 @@ void editor_update(Panel *panel) { TRACE
             }
 
             for (I64 i = 0; i < w->inputs.char_event_count; ++i) {
-                U32 codepoint = w->inputs.char_events[i].codepoint;
-                // enforce ascii for now
-                expect(codepoint < 128);
-
-                U8 codepoint_as_char = (U8)codepoint;
-                editor_text_insert(ed, ed->insert_cursor, &codepoint_as_char, 1);
-                ed->insert_cursor += 1;
+                U8 bytes[4];
+                I64 length = utf8_encode(w->inputs.char_events[i].codepoint, bytes);
+                editor_text_insert(ed, ed->insert_cursor, bytes, length);
+                ed->insert_cursor += length;
             }
 
             bool up = is(special_pressed | special_repeating, special_mask(GLFW_KEY_UP));
             bool down = is(special_pressed | special_repeating, special_mask(GLFW_KEY_DOWN));
             if (up || down) {
                 Range cur_line = editor_group(ed, Group_Line, ed->insert_cursor);
-                I64 idx_in_line = ed->insert_cursor - cur_line.start;
+                I64 column = editor_char_count(ed, cur_line.start, ed->insert_cursor);
 
                 Range target_line = cur_line;
                 if (up) target_line = editor_group(ed, Group_Line, cur_line.start-1);
                 if (down) target_line = editor_group(ed, Group_Line, cur_line.end);
 
-                ed->insert_cursor = target_line.start + idx_in_line;
-                if (ed->insert_cursor > target_line.end)
-                    ed->insert_cursor = target_line.end-1;
+                ed->insert_cursor = editor_char_advance(ed, target_line.start, column, target_line.end-1);
             }
 
             if (is(special_pressed | special_repeating, special_mask(GLFW_KEY_LEFT)))
-                ed->insert_cursor--;
+                ed->insert_cursor = editor_char_start(ed, ed->insert_cursor-1);
             if (is(special_pressed | special_repeating, special_mask(GLFW_KEY_RIGHT)))
-                ed->insert_cursor++;
+                ed->insert_cursor = editor_char_end(ed, ed->insert_cursor);
 
             if (is(special_pressed, special_mask(GLFW_KEY_ENTER))) {
                 Range line = editor_group(ed, Group_Line, ed->insert_cursor);
@@ -683,8 +1029,9 @@ void editor_update(Panel *panel) { TRACE
                     editor_text_remove(ed, word.start, ed->insert_cursor);
                     ed->insert_cursor = word.start;
                 } else {
-                    ed->insert_cursor -= 1;
-                    editor_text_remove(ed, ed->insert_cursor, ed->insert_cursor+1);
+                    I64 start = editor_char_start(ed, ed->insert_cursor-1);
+                    editor_text_remove(ed, start, ed->insert_cursor);
+                    ed->insert_cursor = start;
                 }
             }
             
@@ -694,27 +1041,20 @@ void editor_update(Panel *panel) { TRACE
             for (I64 i = 0; i < w->inputs.char_event_count; ++i) {
                 ed->search_cursor = 0;
 
-                U32 codepoint = w->inputs.char_events[i].codepoint;
-                // enforce ascii for now
-                expect(codepoint < 128);
-
-                U8 codepoint_as_char = (U8)codepoint;
-                ed->mode_text[ed->mode_text_length++] = codepoint_as_char;
+                U8 bytes[4];
+                I64 length = utf8_encode(w->inputs.char_events[i].codepoint, bytes);
+                if (ed->mode_text_length + length > MODE_TEXT_MAX_LENGTH)
+                    break;
+                memcpy(&ed->mode_text[ed->mode_text_length], bytes, (U64)length);
+                ed->mode_text_length += length;
             }
             
-            if (ctrl && is(pressed, key_mask(GLFW_KEY_V))) {
-                const U8 *text = (const U8*) glfwGetClipboardString(NULL);
-                if (text != NULL) {
-                    U32 len = my_strlen(text);
-                    memcpy(&ed->mode_text[ed->mode_text_length], text, len);
-                    ed->mode_text_length += len;
-                }
-            }
+            if (ctrl && is(pressed, key_mask(GLFW_KEY_V)))
+                editor_mode_text_paste(ed->mode_text, &ed->mode_text_length);
 
             if (is(special_pressed | special_repeating, special_mask(GLFW_KEY_BACKSPACE))) {
                 if (!ctrl) {
-                    if (ed->mode_text_length > 0)
-                        ed->mode_text_length--;
+                    ed->mode_text_length = (I64)utf8_char_before(ed->mode_text, (U64)ed->mode_text_length);
                 } else {
                     editor_ctrl_backspace(ed->mode_text, &ed->mode_text_length);
                 }
@@ -723,6 +1063,11 @@ void editor_update(Panel *panel) { TRACE
             if (ctrl && is(pressed, key_mask(GLFW_KEY_R))) {
                 ed->mode = Mode_Replace;
             }
+
+            if (ctrl && is(pressed, key_mask(GLFW_KEY_E))) {
+                ed->search_regex_mode = !ed->search_regex_mode;
+                ed->search_cursor = 0;
+            }
             
             editor_process_search_history(ed);
             editor_search(ed);
@@ -748,8 +1093,8 @@ void editor_update(Panel *panel) { TRACE
             
             if (is(special_pressed, special_mask(GLFW_KEY_ENTER))) { 
                 if (ed->search_match_count > 0) {
-                    I64 shown_match = ed->search_matches[ed->search_cursor];
-                    editor_set_selection(ed, shown_match, shown_match + ed->mode_text_length);
+                    Range shown_match = editor_search_match(ed, ed->search_cursor);
+                    editor_set_selection(ed, shown_match.start, shown_match.end);
                 }
                 
                 PrevSearch *prev_search = &ed->prev_searches[ed->prev_search_count++];
@@ -764,27 +1109,20 @@ void editor_update(Panel *panel) { TRACE
             for (I64 i = 0; i < w->inputs.char_event_count; ++i) {
                 ed->search_cursor = 0;
 
-                U32 codepoint = w->inputs.char_events[i].codepoint;
-                // enforce ascii for now
-                expect(codepoint < 128);
-
-                U8 codepoint_as_char = (U8)codepoint;
-                ed->mode_text_alt[ed->mode_text_alt_length++] = codepoint_as_char;
+                U8 bytes[4];
+                I64 length = utf8_encode(w->inputs.char_events[i].codepoint, bytes);
+                if (ed->mode_text_alt_length + length > MODE_TEXT_MAX_LENGTH)
+                    break;
+                memcpy(&ed->mode_text_alt[ed->mode_text_alt_length], bytes, (U64)length);
+                ed->mode_text_alt_length += length;
             }
             
-            if (ctrl && is(pressed, key_mask(GLFW_KEY_V))) {
-                const U8 *text = (const U8*) glfwGetClipboardString(NULL);
-                if (text != NULL) {
-                    U32 len = my_strlen(text);
-                    memcpy(&ed->mode_text_alt[ed->mode_text_alt_length], text, len);
-                    ed->mode_text_alt_length += len;
-                }
-            }
+            if (ctrl && is(pressed, key_mask(GLFW_KEY_V)))
+                editor_mode_text_paste(ed->mode_text_alt, &ed->mode_text_alt_length);
 
             if (is(special_pressed | special_repeating, special_mask(GLFW_KEY_BACKSPACE))) {
                 if (!ctrl) {
-                    if (ed->mode_text_alt_length > 0)
-                        ed->mode_text_alt_length--;
+                    ed->mode_text_alt_length = (I64)utf8_char_before(ed->mode_text_alt, (U64)ed->mode_text_alt_length);
                 } else {
                     editor_ctrl_backspace(ed->mode_text_alt, &ed->mode_text_alt_length);
                 }
@@ -799,14 +1137,18 @@ void editor_update(Panel *panel) { TRACE
                 ed->mode = Mode_Search;
             
             if (is(special_pressed, special_mask(GLFW_KEY_ENTER))) {
-                I64 i = ed->search_match_count;
-                while (i != 0) {
-                    i--;
-                    I64 match_start = ed->search_matches[i];
-                    I64 match_end = match_start + ed->mode_text_length;
-                    editor_text_remove(ed, match_start, match_end);
-                    editor_text_insert(ed, match_start, ed->mode_text_alt, ed->mode_text_alt_length);
+                while (editor_search_scanning(ed))
+                    editor_search(ed);
+
+                // literal matches can overlap, the earlier one is replaced
+                Range *ranges = ARENA_ALLOC_ARRAY(&w->frame_arena, Range, (U64)ed->search_match_count);
+                U64 range_count = 0;
+                for (I64 i = 0; i < ed->search_match_count; ++i) {
+                    Range match = editor_search_match(ed, i);
+                    if (range_count == 0 || ranges[range_count-1].end <= match.start)
+                        ranges[range_count++] = match;
                 }
+                editor_text_replace_bulk(ed, ranges, range_count, ed->mode_text_alt, ed->mode_text_alt_length);
 
                 PrevSearch *prev_search = &ed->prev_searches[ed->prev_search_count++];
                 editor_copy_to_search_buffer(ed, prev_search);
@@ -851,9 +1193,9 @@ void editor_update(Panel *panel) { TRACE
     {
         if (ed->mode == Mode_Search || ed->mode == Mode_Replace) {
             if (ed->search_match_count > 0) {
-                I64 shown_match = ed->search_matches[ed->search_cursor];
-                I64 line_a = editor_line_index(ed, shown_match);
-                I64 line_b = editor_line_index(ed, shown_match + ed->mode_text_length);
+                Range shown_match = editor_search_match(ed, ed->search_cursor);
+                I64 line_a = editor_line_index(ed, shown_match.start);
+                I64 line_b = editor_line_index(ed, shown_match.end);
                 ed->scroll_y = ((F64)line_a + (F64)line_b) / 2.f;
             }
         } else if (ed->mode == Mode_QuickMove) {
@@ -931,8 +1273,8 @@ void editor_update(Panel *panel) { TRACE
         
         if (byte_visible_start < 0)
             byte_visible_start = 0;
-        if (byte_visible_end > ed->text_length)
-            byte_visible_end = ed->text_length;
+        if (byte_visible_end > ed->buf->text.length)
+            byte_visible_end = ed->buf->text.length;
     }
 
     // mode/selection group colour bar
@@ -1010,13 +1352,11 @@ void editor_update(Panel *panel) { TRACE
         };
     }
     if (ed->mode == Mode_Search || ed->mode == Mode_Replace) {
-        for (I64 i = 0; i < ed->search_match_count; ++i) {
-            I64 match_idx = ed->search_matches[i];
-
-            if (match_idx < byte_visible_start) continue;
-            if (match_idx > byte_visible_end) break;
+        for (I64 i = editor_search_match_find(ed, byte_visible_start); i < ed->search_match_count; ++i) {
+            Range match = editor_search_match(ed, i);
+            if (match.start > byte_visible_end) break;
 
-            Rect rect = editor_line_rect(ed, font_atlas, match_idx, match_idx + ed->mode_text_length, &text_v);
+            Rect rect = editor_line_rect(ed, font_atlas, match.start, match.end, &text_v);
             RGBA8 colour = i != ed->search_cursor ? (RGBA8)COLOUR_SEARCH : (RGBA8)COLOUR_SEARCH_SHOWN;
 
             if (rect.w == 0.f)
@@ -1036,43 +1376,55 @@ void editor_update(Panel *panel) { TRACE
     F64 line_start = (F64)editor_line_index(ed, byte_visible_start);
     F32 line_y = (F32)(line_start - ed->scroll_y_visual) * font_height + text_v.h / 2.f;
     F32 pen_x = 0.f;
-    U32 syntax_range_idx = 0;
+    U32 syntax_range_idx = editor_syntax_range_find(ed, byte_visible_start);
     
-    for (I64 i = byte_visible_start; i < byte_visible_end; ++i) {
-        U8 ch = ed->text[i];
-        if (ch == '\n') {
-            line_y += font_height;
-            pen_x = 0.f;
-            continue;
-        }
-        
-        RGBA8 text_colour = (RGBA8)COLOUR_FOREGROUND;
-        while (syntax_range_idx != ed->syntax_range_count) {
-            SyntaxRange *range = &ed->syntax_lookup[syntax_range_idx];
-            if (range->end < i) {
-                ++syntax_range_idx;
+    for (I64 i = byte_visible_start; i < byte_visible_end;) {
+        TextChunk chunk = text_chunk(&ed->buf->text, i);
+        I64 chunk_end = chunk.start + chunk.length;
+        if (chunk_end > byte_visible_end) chunk_end = byte_visible_end;
+
+        while (i < chunk_end) {
+            U8 ch = chunk.ptr[i - chunk.start];
+            I64 byte = i++;
+            if (ch == '\n') {
+                line_y += font_height;
+                pen_x = 0.f;
                 continue;
             }
+
+            // a sequence may run on into the next chunk
+            U32 codepoint = ch;
+            if (ch >= 0x80 && !ed->buf->ascii)
+                codepoint = editor_codepoint(ed, byte, &i);
             
-            if (range->start <= i)
-                text_colour = range->colour;
-            break;
-        }
+            RGBA8 text_colour = (RGBA8)COLOUR_FOREGROUND;
+            while (syntax_range_idx != ed->buf->syntax_range_count) {
+                SyntaxRange range = editor_syntax_range(ed, syntax_range_idx);
+                if (range.end < (U64)byte) {
+                    ++syntax_range_idx;
+                    continue;
+                }
+                
+                if (range.start <= (U64)byte)
+                    text_colour = ed->buf->syntax.groups[range.group].colour;
+                break;
+            }
 
-        F32 pen_y = line_y + font_height;
+            F32 pen_y = line_y + font_height;
 
-        U32 glyph_idx = glyph_lookup_idx(CODE_FONT_SIZE, ch);
-        GlyphInfo info = font_atlas->glyph_info[glyph_idx];
+            U32 glyph_idx = glyph_lookup_codepoint_idx(CODE_FONT_SIZE, codepoint);
+            GlyphInfo info = font_atlas->glyph_info[glyph_idx];
 
-        if (pen_x + info.advance_width <= text_v.w) {
-            *ui_push_glyph(ui) = (Glyph) {
-                .x = text_v.x + pen_x + info.offset_x,
-                .y = text_v.y + pen_y + info.offset_y,
-                .glyph_idx = glyph_idx,
-                .colour = text_colour,
-            };
+            if (pen_x + info.advance_width <= text_v.w) {
+                *ui_push_glyph(ui) = (Glyph) {
+                    .x = text_v.x + pen_x + info.offset_x,
+                    .y = text_v.y + pen_y + info.offset_y,
+                    .glyph_idx = glyph_idx,
+                    .colour = text_colour,
+                };
+            }
+            pen_x += info.advance_width;
         }
-        pen_x += info.advance_width;
     }
 
     // WRITE MODE INFO GLYPHS -------------------------------------------------
@@ -1101,6 +1453,8 @@ void editor_update(Panel *panel) { TRACE
             int_to_string(&w->frame_arena, ed->search_cursor+1);
             *(U8*)ARENA_ALLOC(&w->frame_arena, U8) = '/';
             int_to_string(&w->frame_arena, ed->search_match_count);
+            if (editor_search_scanning(ed))
+                *(U8*)ARENA_ALLOC(&w->frame_arena, U8) = '+';
         } else {
             colour = (RGBA8) COLOUR_RED;
         }
@@ -1109,6 +1463,10 @@ void editor_update(Panel *panel) { TRACE
             *(U8*)ARENA_ALLOC(&w->frame_arena, U8) = ' ';
         } while (w->frame_arena.head - mode_info_text < 6);
 
+        // regex queries are shown after a slash
+        if (ed->search_regex_mode)
+            *(U8*)ARENA_ALLOC(&w->frame_arena, U8) = '/';
+
         // show selection text
         U8 *copied_mode_text = ARENA_ALLOC_ARRAY(&w->frame_arena, U8, (U64)ed->mode_text_length);
         for (I64 i = 0; i < ed->mode_text_length; ++i)
@@ -1221,7 +1579,7 @@ void editor_update(Panel *panel) { TRACE
         status_x += 10.f; 
 
         // unsaved [+] symbol 
-        if (ed->flags & EditorFlag_Unsaved) {
+        if (ed->buf->flags & EditorFlag_Unsaved) {
             status_x += ui_push_string_terminated(
                 ui,
                 (const U8*)"[+]",
@@ -1232,13 +1590,106 @@ void editor_update(Panel *panel) { TRACE
             status_x += 10.f;
         } 
         
+        // indexing progress, streams only know how much has been read
+        if (ed->buf->loader.running) {
+            bool stream = ed->buf->loader.stream_fd >= 0;
+            U64 progress = stream
+                ? ed->buf->text.original_loaded / MB
+                : ed->buf->text.original_loaded * 100 / ed->buf->text.original_length;
+            U8 *progress_str = w->frame_arena.head;
+            U64 progress_str_len = int_to_string(&w->frame_arena, (I64)progress);
+            if (stream) {
+                memcpy(ARENA_ALLOC_ARRAY(&w->frame_arena, U8, 2), "MB", 2);
+                progress_str_len += 2;
+            } else {
+                *(U8*)ARENA_ALLOC(&w->frame_arena, U8) = '%';
+                progress_str_len += 1;
+            }
+            status_x += ui_push_string(
+                ui,
+                progress_str, progress_str_len,
+                font_atlas,
+                (RGBA8) COLOUR_ORANGE, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        }
+        
+        // saving progress, or why the last save failed
+        EditorSaver *sv = &ed->buf->saver;
+        if (sv->running) {
+            pthread_mutex_lock(&sv->mutex);
+            U64 written = sv->written;
+            pthread_mutex_unlock(&sv->mutex);
+
+            U8 *saving_str = w->frame_arena.head;
+            U64 saving_str_len = 8;
+            memcpy(ARENA_ALLOC_ARRAY(&w->frame_arena, U8, 8), "[saving ", 8);
+            saving_str_len += int_to_string(&w->frame_arena, sv->length ? (I64)(written * 100 / sv->length) : 100);
+            memcpy(ARENA_ALLOC_ARRAY(&w->frame_arena, U8, 2), "%]", 2);
+            saving_str_len += 2;
+            status_x += ui_push_string(
+                ui,
+                saving_str, saving_str_len,
+                font_atlas,
+                (RGBA8) COLOUR_ORANGE, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        } else if (sv->error) {
+            status_x += ui_push_string_terminated(
+                ui,
+                (const U8*)sv->error,
+                font_atlas,
+                (RGBA8) COLOUR_RED, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        }
+
+        // someone else wrote the file over unsaved edits
+        if (ed->buf->disk_conflict) {
+            status_x += ui_push_string_terminated(
+                ui,
+                (const U8*)"[changed on disk]",
+                font_atlas,
+                (RGBA8) COLOUR_RED, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        }
+        
+        // bytes that aren't UTF-8 are shown one glyph each
+        if (ed->buf->utf8_invalid) {
+            status_x += ui_push_string_terminated(
+                ui,
+                (const U8*)"[not utf-8]",
+                font_atlas,
+                (RGBA8) COLOUR_ORANGE, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        }
+        
+        // following appends
+        if (ed->buf->follow.fd >= 0) {
+            status_x += ui_push_string_terminated(
+                ui,
+                (const U8*)"[follow]",
+                font_atlas,
+                (RGBA8) COLOUR_GREEN, CODE_FONT_SIZE,
+                status_x, status_y, status_max_x
+            );
+            status_x += 10.f;
+        }
+        
         // filename 
-        if (ed->filepath) {
-            U32 filepath_start = ed->filepath_length-1;
+        if (ed->buf->filepath) {
+            U32 filepath_start = ed->buf->filepath_length-1;
             U32 slash_count = 1;
             while (1) {
                 if (filepath_start == 0) break;
-                if (ed->filepath[filepath_start-1] == '/') {
+                if (ed->buf->filepath[filepath_start-1] == '/') {
                     if (slash_count == 0) break;
                     slash_count--;
                 }
@@ -1247,7 +1698,7 @@ void editor_update(Panel *panel) { TRACE
     
             status_x += ui_push_string(
                 ui,
-                ed->filepath + filepath_start, ed->filepath_length - filepath_start,
+                ed->buf->filepath + filepath_start, ed->buf->filepath_length - filepath_start,
                 font_atlas,
                 (RGBA8) COLOUR_FOREGROUND, CODE_FONT_SIZE,
                 status_x, status_y, status_max_x
@@ -1294,18 +1745,18 @@ Rect editor_line_rect(Editor *ed, FontAtlas *font_atlas, I64 a, I64 b, Rect *tex
     {
         I64 i = line.start;
         x = text_v->x;
-        for (; i < a; ++i) {
-            U8 ch = editor_text(ed, i);
-            U32 glyph_idx = glyph_lookup_idx(CODE_FONT_SIZE, ch);
+        while (i < a) {
+            U32 codepoint = editor_codepoint(ed, i, &i);
+            U32 glyph_idx = glyph_lookup_codepoint_idx(CODE_FONT_SIZE, codepoint);
             GlyphInfo info = font_atlas->glyph_info[glyph_idx];
             x += info.advance_width;
         }
 
         width = 0;
         I64 end = line.end < b ? line.end : b;
-        for (; i < end; ++i) {
-            U8 ch = editor_text(ed, i);
-            U32 glyph_idx = glyph_lookup_idx(CODE_FONT_SIZE, ch);
+        while (i < end) {
+            U32 codepoint = editor_codepoint(ed, i, &i);
+            U32 glyph_idx = glyph_lookup_codepoint_idx(CODE_FONT_SIZE, codepoint);
             GlyphInfo info = font_atlas->glyph_info[glyph_idx];
             width += info.advance_width;
             
@@ -1329,82 +1780,255 @@ Rect editor_line_rect(Editor *ed, FontAtlas *font_atlas, I64 a, I64 b, Rect *tex
     return (Rect) { x, y, width, height };
 }
 
-static const char *read_file_to_buffer_err(I64 f) {
-    if (f == -1) return "File does not exist, or you have insufficient permissions";
-    if (f == -2) return "Could not read file size";
-    if (f == -3) return "File is too large";
-    if (f == -4) return "Could not read file";
-    if (f == -5) return "Could not close file";
-    return "Error message not implemented";
+// Returns a readable fd if `filepath` is "-" for stdin or names a FIFO,
+// otherwise -1. The fd is the loader's to close, and a FIFO is opened
+// without waiting for a writer, the stream thread polls for one.
+static int editor_stream_open(const char *filepath) {
+    if (strcmp(filepath, "-") == 0)
+        return fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+
+    struct stat st;
+    if (stat(filepath, &st) != 0 || !S_ISFIFO(st.st_mode))
+        return -1;
+    return open(filepath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
 }
 
-static I64 read_file_to_buffer(U8 *buffer, U64 buffer_size, const U8 *filepath) {
-    FILE *f = fopen((const char*)filepath, "rb");
-    if (f == NULL) return -1;
-    
-    I64 fsize = file_size(f);
-    if (fsize < 0) {
-        fclose(f);
-        return -2;
-    }
-
-    if ((U64)fsize > buffer_size) return -3;
-
-    if (fsize != 0 && fread(buffer, (U64)fsize, 1, f) != 1) {
-        fclose(f);
-        return -4;
+int editor_load_filepath(Editor *ed, const U8 *filepath, U32 filepath_length) { TRACE
+    // the path may belong to the buffer being let go
+    char path[PATH_MAX];
+    if (filepath_length >= sizeof(path)) return -1;
+    memcpy(path, filepath, filepath_length);
+    path[filepath_length] = 0;
+
+    editor_release_buffer(ed);
+
+    char real_path[PATH_MAX];
+    bool has_real_path = realpath(path, real_path) != NULL;
+    Buffer *buf = has_real_path ? buffer_find(real_path) : NULL;
+    if (buf) {
+        // another view of it shows where that view is
+        Editor *view = buf->views;
+        editor_attach_buffer(ed, buf);
+        if (view) {
+            ed->selection_group = view->selection_group;
+            editor_set_selection(ed, view->selection_base, view->selection_head);
+            ed->scroll_y = view->scroll_y;
+        } else {
+            ed->selection_group = buf->view_selection_group;
+            editor_set_selection(ed, buf->view_selection_base, buf->view_selection_head);
+            ed->scroll_y = buf->view_scroll_y;
+        }
+        ed->scroll_y_visual = ed->scroll_y;
+        return 0;
     }
 
-    if (fclose(f) != 0) return -5;
+    buf = buffer_create();
+    editor_attach_buffer(ed, buf);
+    U8 *arena_filepath = ARENA_ALLOC_ARRAY(&buf->arena, U8, filepath_length+1);
+    memcpy(arena_filepath, path, filepath_length+1);
 
-    return fsize;
-}
+    SyntaxHighlighting *syntax = syntax_for_path(arena_filepath, filepath_length);
+    buf->syntax = syntax ? *syntax : (SyntaxHighlighting){0};
+
+    // streams are read as they arrive, and have nowhere to be saved to
+    int stream_fd = editor_stream_open(path);
+    I64 size = stream_fd < 0 ? text_open_file(&buf->text, path) : 0;
+    if (stream_fd >= 0) {
+        editor_stream_start(ed, stream_fd);
+    } else if (size >= 0) {
+        buf->filepath = arena_filepath;
+        buf->filepath_length = filepath_length;
+        if (has_real_path) {
+            memcpy(buf->real_path, real_path, sizeof(real_path));
+            buffer_stat_file(buf);
+            buffer_list(buf);
+            buffer_watch(buf);
+        }
 
-int editor_load_filepath(Editor *ed, const U8 *filepath, U32 filepath_length) { TRACE
-    // TODO: this leaks - allocates for each opened file
-    // Change to reusable staticly sized buffer
-    U8 *arena_filepath = ARENA_ALLOC_ARRAY(ed->arena, U8, filepath_length+1);
-    memcpy(arena_filepath, filepath, filepath_length);
-    arena_filepath[filepath_length] = 0;
-
-    editor_clear_file(ed);
-    undo_clear(&ed->undo_stack);
-
-    I64 size = read_file_to_buffer(ed->text, TEXT_MAX_LENGTH, arena_filepath);
-    if (size >= 0) {
-        ed->text_length = size;
-        ed->filepath = arena_filepath;
-        ed->filepath_length = filepath_length;
+        // the file holds what was mapped
+        EditorSaver *sv = &buf->saver;
+        sv->mapped_inode = buf->file_inode;
+        sv->disk_spans[0] = (TextChunk) { .ptr = buf->text.original, .length = size };
+        sv->disk_span_count = size != 0;
+        // the history is hashed against while loading, if it could be the file's
+        editor_history_path(ed);
+        buf->loader.hash_content = undo_history_exists(buf->history_path, (U64)size);
+        buf->loader.history_pending = buf->loader.hash_content;
+        editor_load_start(ed);
     } else {
-        const char *err = read_file_to_buffer_err(size);
+        const char *err = text_open_file_err(size);
         fprintf(stderr, "Error reading file: %s\n", err);
-
-        ed->text_length = 0;
-        ed->filepath = NULL;
-        ed->filepath_length = 0;
     }
-    SyntaxHighlighting *syntax = syntax_for_path(arena_filepath, filepath_length);
-    ed->syntax = syntax ? *syntax : (SyntaxHighlighting){0};
+
+    // the rest loads in the background
+    editor_load_wait(ed, 0);
 
     ed->selection_group = Group_Line;
     editor_set_selection(ed, 0, editor_group(ed, Group_Line, 0).end);
-    ed->flags &= ~(U32)EditorFlag_Unsaved;
-    
-    editor_remake_caches(ed);
+    buf->flags &= ~(U32)EditorFlag_Unsaved;
 
     return 0;
 }
 
-void editor_clear_file(Editor *ed) { TRACE
-    ed->filepath_length = 0;
-    ed->filepath = NULL;
-    ed->text_length = 0;
+// The history file is named after a hash of the file's full path.
+static void editor_history_path(Editor *ed) {
+    ed->buf->history_path[0] = 0;
+    const char *home = getenv("HOME");
+    char path[PATH_MAX];
+    if (home == NULL || realpath((const char*)ed->buf->filepath, path) == NULL)
+        return;
+
+    UndoHash hs = {0};
+    undo_hash_update(&hs, (const U8*)path, strlen(path));
+    snprintf(ed->buf->history_path, sizeof(ed->buf->history_path), "%s/%s/%016llx",
+        home, UNDO_HISTORY_DIR, (unsigned long long)undo_hash_final(&hs));
+}
+
+// Picks up the history kept for the file, now that what was read of it
+// is hashed, unless a save has written over it since.
+static void editor_history_open(Editor *ed, UndoHash *hs, U64 content_length) { TRACE
+    EditorLoader *ld = &ed->buf->loader;
+    if (!ld->history_pending) return;
+    ld->history_pending = false;
+    undo_history_open(&ed->buf->undo_stack, ed->buf->history_path, undo_hash_final(hs), content_length);
+}
+
+// Keeps the undo history for the text just saved, which hashed to
+// `content_hash`. Nothing is lost but the history if it can't be written.
+static void editor_history_save(Editor *ed, U64 content_hash, U64 content_length) { TRACE
+    ed->buf->loader.history_pending = false;
+    (void)undo_history_write(&ed->buf->undo_stack, ed->buf->history_path, content_hash, content_length);
+}
+
+static void editor_attach_buffer(Editor *ed, Buffer *buf) {
+    ed->buf = buf;
+    ed->view_next = buf->views;
+    buf->views = ed;
+    buf->refs++;
+}
+
+// Lets go of the editor's buffer, keeping what the view was in it.
+static void editor_release_buffer(Editor *ed) { TRACE
+    Buffer *buf = ed->buf;
+    if (buf->insert_view == ed)
+        editor_insert_end(buf);
+
+    Editor **link = &buf->views;
+    while (*link != ed)
+        link = &(*link)->view_next;
+    *link = ed->view_next;
+    ed->view_next = NULL;
+
+    buf->view_selection_base = ed->selection_base;
+    buf->view_selection_head = ed->selection_head;
+    buf->view_selection_group = ed->selection_group;
+    buf->view_scroll_y = ed->scroll_y;
+    buffer_release(buf);
+    ed->buf = NULL;
+
+    // the matches were for that text
+    ed->search_query_length = -1;
+}
+
+// Reads the file anew into a buffer of its own, moving every view of the old
+// one onto it where they were.
+static void editor_reopen(Editor *ed) { TRACE
+    Buffer *old = ed->buf;
+    U32 others = old->refs - 1;
+    char path[PATH_MAX];
+    U32 path_length = old->filepath_length;
+    memcpy(path, old->filepath, path_length);
+
+    buffer_unlist(old);
+    for (U32 i = 0; i <= others; ++i) {
+        // the old buffer is gone once the last view lets go
+        Editor *view = i == 0 ? ed : old->views;
+        I64 base = view->selection_base;
+        I64 head = view->selection_head;
+        F64 scroll_y = view->scroll_y;
+
+        editor_load_filepath(view, (const U8*)path, path_length);
+        I64 length = view->buf->text.length;
+        editor_set_selection(view, clamp(base, 0, length), clamp(head, 0, length));
+        view->scroll_y = scroll_y;
+    }
+}
+
+static I64 editor_shift_position(I64 pos, I64 start, I64 end, I64 length) {
+    if (pos >= end) return pos - (end - start) + length;
+    if (pos > start) return start;
+    return pos;
+}
+
+// Keeps the other views of the buffer where they were over an edit that
+// replaced [start, end) with `length` bytes.
+static void editor_shift_views(Editor *ed, I64 start, I64 end, I64 length) {
+    for (Editor *view = ed->buf->views; view; view = view->view_next) {
+        if (view == ed) continue;
+        editor_set_selection(view,
+            editor_shift_position(view->selection_base, start, end, length),
+            editor_shift_position(view->selection_head, start, end, length)
+        );
+        view->insert_cursor = editor_shift_position(view->insert_cursor, start, end, length);
+    }
 }
 
 static inline U8 editor_text(Editor *ed, I64 byte) {
     if (byte < 0) return '\n';
-    if (byte >= ed->text_length) return '\n';
-    return ed->text[byte];
+    if (byte >= ed->buf->text.length) return '\n';
+    return text_byte(&ed->buf->text, byte);
+}
+
+// Codepoints are read a byte at a time through editor_text,
+// which an ASCII buffer skips straight to.
+
+// returns the codepoint at `byte`, setting `end` past it
+static U32 editor_codepoint(Editor *ed, I64 byte, I64 *end) {
+    U8 c = editor_text(ed, byte);
+    if (c < 0x80 || ed->buf->ascii) {
+        *end = byte + 1;
+        return c;
+    }
+
+    U8 seq[4] = { c, editor_text(ed, byte+1), editor_text(ed, byte+2), editor_text(ed, byte+3) };
+    U32 codepoint;
+    *end = byte + utf8_decode(seq, 4, &codepoint);
+    return codepoint;
+}
+
+static I64 editor_char_end(Editor *ed, I64 byte) {
+    I64 end;
+    editor_codepoint(ed, byte, &end);
+    return end;
+}
+
+// returns the start of the codepoint holding `byte`
+static I64 editor_char_start(Editor *ed, I64 byte) {
+    if (ed->buf->ascii || !utf8_continuation(editor_text(ed, byte)))
+        return byte;
+    for (I64 start = byte-1; start >= byte-3 && start >= 0; --start) {
+        if (utf8_continuation(editor_text(ed, start)))
+            continue;
+        return editor_char_end(ed, start) > byte ? start : byte;
+    }
+    return byte;
+}
+
+// returns the byte `count` codepoints past `byte`, or `limit` if that's sooner
+static I64 editor_char_advance(Editor *ed, I64 byte, I64 count, I64 limit) {
+    if (ed->buf->ascii)
+        return byte + count < limit ? byte + count : limit;
+    for (; count > 0 && byte < limit; --count)
+        byte = editor_char_end(ed, byte);
+    return byte < limit ? byte : limit;
+}
+
+static I64 editor_char_count(Editor *ed, I64 start, I64 end) {
+    if (ed->buf->ascii) return end - start;
+    I64 count = 0;
+    for (I64 i = start; i < end; i = editor_char_end(ed, i))
+        count++;
+    return count;
 }
 
 bool range_all_whitespace(Editor *ed, Range range) {
@@ -1418,7 +2042,7 @@ bool range_all_whitespace(Editor *ed, Range range) {
 Range editor_group_range_paragraph(Editor *ed, I64 byte) { TRACE
     // not much we can do here
     if (byte < 0) byte = 0;
-    if (byte >= ed->text_length) byte = ed->text_length;
+    if (byte >= ed->buf->text.length) byte = ed->buf->text.length;
 
     I64 start = byte;
     if (range_all_whitespace(ed, editor_group(ed, Group_Line, start))) {
@@ -1437,13 +2061,13 @@ Range editor_group_range_paragraph(Editor *ed, I64 byte) { TRACE
     }
 
     I64 end = byte;
-    while (end < ed->text_length) {
+    while (end < ed->buf->text.length) {
         Range line = editor_group(ed, Group_Line, end);
         end = line.end;
         if (range_all_whitespace(ed, line))
             break;
     }
-    while (end < ed->text_length) {
+    while (end < ed->buf->text.length) {
         Range line = editor_group(ed, Group_Line, end);
         if (!range_all_whitespace(ed, line))
             break;
@@ -1453,14 +2077,14 @@ Range editor_group_range_paragraph(Editor *ed, I64 byte) { TRACE
     //I64 end = byte;
     //while (editor_text(ed, end) != '\n' || editor_text(ed, end-1) != '\n')
         //end++;
-    //while (editor_text(ed, end) == '\n' && end < ed->text_length)
+    //while (editor_text(ed, end) == '\n' && end < ed->buf->text.length)
         //end++;
      
     return (Range) { start, end };
 }
 
 Range editor_group_range_line(Editor *ed, I64 byte) { TRACE
-    if (byte < 0 || byte > ed->text_length)
+    if (byte < 0 || byte > ed->buf->text.length)
         return (Range) { byte, byte+1 };
 
     I64 start = byte;
@@ -1476,7 +2100,7 @@ Range editor_group_range_line(Editor *ed, I64 byte) { TRACE
 Range editor_group_range_word(Editor *ed, I64 byte) { TRACE
     // not much we can do here
     if (byte < 0) byte = 0;
-    if (byte >= ed->text_length) byte = ed->text_length-1;
+    if (byte >= ed->buf->text.length) byte = ed->buf->text.length-1;
 
     I64 start = byte;
     while (start > 0 && char_whitespace(editor_text(ed, start)))
@@ -1496,9 +2120,9 @@ Range editor_group_range_word(Editor *ed, I64 byte) { TRACE
         start--;
 
     I64 end = start+1;
-    while (end < ed->text_length && char_fn(editor_text(ed, end)))
+    while (end < ed->buf->text.length && char_fn(editor_text(ed, end)))
         end++;
-    while (end < ed->text_length && (char_whitespace(editor_text(ed, end))))
+    while (end < ed->buf->text.length && (char_whitespace(editor_text(ed, end))))
         end++;
 
     return (Range) { start, end };
@@ -1507,7 +2131,7 @@ Range editor_group_range_word(Editor *ed, I64 byte) { TRACE
 Range editor_group_range_subword(Editor *ed, I64 byte) { TRACE
     // not much we can do here
     if (byte < 0) byte = 0;
-    if (byte >= ed->text_length) byte = ed->text_length-1;
+    if (byte >= ed->buf->text.length) byte = ed->buf->text.length-1;
 
     I64 start = byte;
     while (start > 0 && (char_whitespace(editor_text(ed, start)) || editor_text(ed, start) == '_'))
@@ -1527,9 +2151,9 @@ Range editor_group_range_subword(Editor *ed, I64 byte) { TRACE
         start--;
 
     I64 end = start+1;
-    while (end < ed->text_length && char_fn(editor_text(ed, end)))
+    while (end < ed->buf->text.length && char_fn(editor_text(ed, end)))
         end++;
-    while (end < ed->text_length && (char_whitespace(editor_text(ed, end)) || editor_text(ed, end) == '_'))
+    while (end < ed->buf->text.length && (char_whitespace(editor_text(ed, end)) || editor_text(ed, end) == '_'))
         end++;
 
     return (Range) { start, end };
@@ -1545,8 +2169,10 @@ Range editor_group(Editor *ed, Group group, I64 byte) { TRACE
             return editor_group_range_word(ed, byte);
         case Group_SubWord:
             return editor_group_range_subword(ed, byte);
-        case Group_Character:
-            return (Range) { byte, byte+1 };
+        case Group_Character: {
+            I64 start = editor_char_start(ed, byte);
+            return (Range) { start, editor_char_end(ed, start) };
+        }
         default:
             expect(0);
             return (Range) {0};
@@ -1563,35 +2189,18 @@ Range editor_group_prev(Editor *ed, Group group, I64 current_group_start) { TRAC
 
 I64 editor_line_index(Editor *ed, I64 byte) { TRACE
     if (byte < 0) return byte;
-    if (byte >= ed->text_length)
-        return (I64)ed->line_count + (byte - ed->text_length);
-    if (ed->line_count == 0)
-        return byte;
-        
-    I64 a = 0;
-    I64 b = (I64)ed->line_count-1; 
-    U32 *line_lookup = ed->line_lookup;
-    U32 byte_u32 = (U32)byte;
-    
-    while (a <= b) {
-        I64 mid = a + (b - a) / 2;
-        U32 line_a = line_lookup[mid];
-        U32 line_b = line_lookup[mid+1];
-        
-        if (byte_u32 < line_a) b = mid - 1;
-        else if (byte_u32 >= line_b) a = mid + 1;
-        else return mid;
-    }
-    
-    return a;
+    if (byte >= ed->buf->text.length)
+        return text_line_count(&ed->buf->text) + (byte - ed->buf->text.length);
+    return text_line_index(&ed->buf->text, byte);
 }
 
 I64 editor_byte_index(Editor *ed, I64 line) { TRACE
     if (line < 0)
         return line;
-    if (line > ed->line_count)
-        return ed->line_lookup[ed->line_count] + line - ed->line_count;
-    return ed->line_lookup[line];
+    I64 line_count = text_line_count(&ed->buf->text);
+    if (line > line_count)
+        return ed->buf->text.length + line - line_count;
+    return text_line_start(&ed->buf->text, line);
 }
 
 void editor_text_remove(Editor *ed, I64 start, I64 end) { TRACE
@@ -1602,16 +2211,21 @@ void editor_text_remove(Editor *ed, I64 start, I64 end) { TRACE
     }
     if (start < 0) start = 0;
     if (end < 0) end = 0;
-    if (start > ed->text_length) start = ed->text_length;
-    if (end > ed->text_length) end = ed->text_length;
-
-    undo_record(&ed->undo_stack, start, &ed->text[start], end - start, UndoOp_Remove);
+    if (start > ed->buf->text.length) start = ed->buf->text.length;
+    if (end > ed->buf->text.length) end = ed->buf->text.length;
+
+    if (start != end) {
+        editor_insert_yield(ed);
+        U8 *undo_text = undo_record(&ed->buf->undo_stack, start, end - start, UndoOp_Remove);
+        if (undo_text) text_copy(&ed->buf->text, undo_text, start, end);
+        ed->buf->flags |= EditorFlag_Unsaved;
+    }
     editor_text_remove_raw(ed, start, end);
-    if (start != end)
-        ed->flags |= EditorFlag_Unsaved;
 }
 
 void editor_text_remove_raw(Editor *ed, I64 start, I64 end) { TRACE
+    editor_shift_views(ed, start, end, 0);
+
     if (start <= ed->selection_a && ed->selection_a < end) {
         editor_set_selection(ed, start, ed->selection_b);
     } else if (end <= ed->selection_a) {
@@ -1624,143 +2238,1586 @@ void editor_text_remove_raw(Editor *ed, I64 start, I64 end) { TRACE
         editor_set_selection(ed, ed->selection_a, ed->selection_b - (end - start));
     }
 
-    U64 to_move = (U64)(ed->text_length - end);
-    ed->text_length -= end - start;
-    memmove(&ed->text[start], &ed->text[end], to_move);
+    I64 lex_start = editor_syntax_begin_edit(ed, start);
+    text_remove(&ed->buf->text, start, end);
+    I64 lex_end = start;
 
-    // force newline termination cuz it makes math a lot simpler
-    if (ed->text[ed->text_length-1] != '\n') {
-        ed->text[ed->text_length++] = '\n';
+    // force newline termination cuz it makes math a lot simpler,
+    // unless the rest of the file is still being loaded after it
+    bool unterminated = ed->buf->text.length == 0 || editor_text(ed, ed->buf->text.length-1) != '\n';
+    if (unterminated && !text_loading(&ed->buf->text)) {
+        text_insert(&ed->buf->text, ed->buf->text.length, (const U8*)"\n", 1);
+        lex_end = ed->buf->text.length;
     }
     
-    editor_remake_caches(ed);
+    editor_syntax_lex(ed, lex_start, lex_end);
 }
 
 void editor_text_insert(Editor *ed, I64 at, U8 *text, I64 length) { TRACE
     expect(length >= 0);
-    expect(ed->text_length + length <= (I64)TEXT_MAX_LENGTH);
 
     if (length != 0) {
-        undo_record(&ed->undo_stack, at, text, length, UndoOp_Insert);
+        editor_insert_yield(ed);
+        U8 *undo_text = undo_record(&ed->buf->undo_stack, at, length, UndoOp_Insert);
+        if (undo_text) memcpy(undo_text, text, (U64)length);
         editor_text_insert_raw(ed, at, text, length);
-        ed->flags |= EditorFlag_Unsaved;
+        ed->buf->flags |= EditorFlag_Unsaved;
+    }
+}
+
+// Removes ranges sorted by start that don't overlap, as one undo group.
+// They go back to front, so the offsets stay valid and the syntax gap and
+// relexing only move one way over the text.
+void editor_text_remove_bulk(Editor *ed, Range *ranges, U64 remove_count) { TRACE
+    editor_insert_yield(ed);
+    undo_group_begin(&ed->buf->undo_stack);
+    for (U64 i = remove_count; i != 0; --i) {
+        Range range = ranges[i-1];
+        expect(i == 1 || ranges[i-2].end <= range.start);
+        editor_text_remove(ed, range.start, range.end);
+    }
+    undo_group_end(&ed->buf->undo_stack);
+}
+
+// Inserts at offsets sorted in increasing order, all into the text as it was
+// before the first one, as one undo group.
+void editor_text_insert_bulk(Editor *ed, Insertion *insertions, U64 insert_count) { TRACE
+    editor_insert_yield(ed);
+    undo_group_begin(&ed->buf->undo_stack);
+    for (U64 i = insert_count; i != 0; --i) {
+        Insertion ins = insertions[i-1];
+        expect(i == 1 || insertions[i-2].at <= ins.at);
+        editor_text_insert(ed, ins.at, ins.text, (I64)ins.text_len);
     }
+    undo_group_end(&ed->buf->undo_stack);
+}
+
+// Replaces ranges sorted by start that don't overlap with `text`, as one undo group.
+void editor_text_replace_bulk(Editor *ed, Range *ranges, U64 range_count, U8 *text, I64 length) { TRACE
+    editor_insert_yield(ed);
+    undo_group_begin(&ed->buf->undo_stack);
+    for (U64 i = range_count; i != 0; --i) {
+        Range range = ranges[i-1];
+        expect(i == 1 || ranges[i-2].end <= range.start);
+        editor_text_remove(ed, range.start, range.end);
+        editor_text_insert(ed, range.start, text, length);
+    }
+    undo_group_end(&ed->buf->undo_stack);
+}
+
+static void editor_text_insert_newlines(Editor *ed, I64 at, I64 count) {
+    if (count <= 0) return;
+    U8 *newlines = ARENA_ALLOC_ARRAY(&w->frame_arena, U8, (U64)count);
+    memset(newlines, '\n', (U64)count);
+    text_insert(&ed->buf->text, at, newlines, count);
 }
 
 void editor_text_insert_raw(Editor *ed, I64 at, U8 *text, I64 length) { TRACE
     if (length == 0) return;
+    if (ed->buf->ascii && utf8_ascii_length(text, (U64)length) != (U64)length)
+        ed->buf->ascii = false;
+    I64 old_length = ed->buf->text.length;
+    I64 view_at = clamp(at, 0, old_length);
 
     if (at <= ed->selection_a)
         ed->selection_a += length;
     if (at <= ed->selection_b)
         ed->selection_b += length;
 
+    // the text after the insertion is untouched
+    I64 lex_start = editor_syntax_begin_edit(ed, clamp(at, 0, ed->buf->text.length));
+    I64 suffix_length = ed->buf->text.length - clamp(at, 0, ed->buf->text.length);
+
     if (at < 0) {
         I64 created = -(at + length);
         if (created < 0) created = 0;
         ed->selection_a += created;
         ed->selection_b += created;
-        ed->text_length += created;
-        memmove(&ed->text[created+length], ed->text, (U64)ed->text_length);
-        memset(&ed->text[length], '\n', (U64)created);
+        editor_text_insert_newlines(ed, 0, created);
         at = 0;
-    } else if (at > ed->text_length) {
-        I64 created = at - ed->text_length;
-        ed->text_length += created;
-        memset(&ed->text[ed->text_length], '\n', (U64)(at - ed->text_length));
-    } else {
-        memmove(&ed->text[at+length], &ed->text[at], (U64)(ed->text_length - at));
+    } else if (at > ed->buf->text.length) {
+        editor_text_insert_newlines(ed, ed->buf->text.length, at - ed->buf->text.length);
     }
 
-    ed->text_length += length;
-    memcpy(&ed->text[at], text, (U64)length);
+    text_insert(&ed->buf->text, at, text, length);
+    I64 lex_end = ed->buf->text.length - suffix_length;
     
-    // force newline termination cuz it makes math a lot simpler
-    if (ed->text[ed->text_length-1] != '\n') {
-        ed->text[ed->text_length++] = '\n';
+    // force newline termination cuz it makes math a lot simpler,
+    // unless the rest of the file is still being loaded after it
+    if (editor_text(ed, ed->buf->text.length-1) != '\n' && !text_loading(&ed->buf->text)) {
+        text_insert(&ed->buf->text, ed->buf->text.length, (const U8*)"\n", 1);
+        lex_end = ed->buf->text.length;
     }
     
-    editor_remake_caches(ed);
+    editor_syntax_lex(ed, lex_start, lex_end);
+    editor_shift_views(ed, view_at, view_at, ed->buf->text.length - old_length);
 }
 
-void editor_remake_caches(Editor *ed) {
-    U32 syntax_range = 0;
-    U32 text_length = (U32)ed->text_length;
+// SYNTAX HIGHLIGHTING #######################################################
+//
+// The lexer state at a byte is the group of the range containing it, so any
+// line start works as a checkpoint without storing anything extra. An edit
+// lexes from the start of its line and stops at the first line start after it
+// where the state matches the old ranges again.
+
+// returns range `idx` with byte offsets
+static inline SyntaxRange editor_syntax_range(Editor *ed, U32 idx) {
+    if (idx < ed->buf->syntax_gap)
+        return ed->buf->syntax_lookup[idx];
+
+    SyntaxRange range = ed->buf->syntax_lookup[SYNTAX_MAX_RANGE_COUNT - ed->buf->syntax_range_count + idx];
+    range.start = (U64)ed->buf->text.length - range.start;
+    range.end = (U64)ed->buf->text.length - range.end;
+    return range;
+}
 
-    SyntaxGroup *current_syntax_group = NULL;
-    SyntaxRange *current_range = NULL;
-    
-    U64 char_is_syntax_start[4];
-    memcpy(char_is_syntax_start, ed->syntax.char_is_syntax_start, sizeof(char_is_syntax_start));
-    
-    U32 line_count = 0;
-    ed->line_lookup[line_count++] = 0;
-    
-    for (U32 i = 0; i < text_length; ++i) {
-        U8 ch = ed->text[i];
-        
-        if (ch == '\n')
-            ed->line_lookup[line_count++] = i+1;
-        
-        if (current_syntax_group == NULL) {
-            U64 bit = 1ull << ((U64)ch & 63ull);
-            U64 arr = (U64)ch >> 6ull;
-            U64 start_mask = char_is_syntax_start[arr];
-            if ((start_mask & bit) == 0)
-                continue;
-        
-            U8 ch_next = editor_text(ed, i+1);
-            U64 group_count = ed->syntax.group_count;
-             
-            for (U64 j = 0; j < group_count; ++j) {
-                SyntaxGroup *group = &ed->syntax.groups[j];
-                U8 *start_chars = group->start_chars;
-                bool match_0 = start_chars[0] == ch;
-                bool match_1 = start_chars[1] == 0 || start_chars[1] == ch_next;
-    
-                if (match_0 & match_1) {
-                    current_syntax_group = group;
-                    current_range = &ed->syntax_lookup[syntax_range++];
-                    current_range->start = i;
-                    current_range->colour = group->colour;
-                    break;
-                }
-            }
-        } else {
-            U8 ch_prev = editor_text(ed, i-1);
-            U8 *end_chars = current_syntax_group->end_chars;
-            bool end;
-            I64 end_count;
+// returns the index of the first range ending at or after `byte`
+static U32 editor_syntax_range_find(Editor *ed, I64 byte) {
+    U32 low = 0;
+    U32 high = ed->buf->syntax_range_count;
+    while (low < high) {
+        U32 mid = low + (high - low) / 2;
+        if (editor_syntax_range(ed, mid).end < (U64)byte)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Moves the gap in front of the first range starting at or after `byte`.
+// Offsets are converted against the current text length, so this must
+// happen before the text changes.
+static void editor_syntax_move_gap(Editor *ed, I64 byte) {
+    SyntaxRange *ranges = ed->buf->syntax_lookup;
+    U64 length = (U64)ed->buf->text.length;
+    U64 after = SYNTAX_MAX_RANGE_COUNT - ed->buf->syntax_range_count;
+
+    while (ed->buf->syntax_gap != 0 && ranges[ed->buf->syntax_gap-1].start >= (U64)byte) {
+        U32 idx = --ed->buf->syntax_gap;
+        SyntaxRange range = ranges[idx];
+        range.start = length - range.start;
+        range.end = length - range.end;
+        ranges[after + idx] = range;
+    }
+
+    while (ed->buf->syntax_gap != ed->buf->syntax_range_count) {
+        U32 idx = ed->buf->syntax_gap;
+        SyntaxRange range = ranges[after + idx];
+        if ((I64)(length - range.start) >= byte)
+            break;
+        range.start = length - range.start;
+        range.end = length - range.end;
+        ranges[idx] = range;
+        ed->buf->syntax_gap++;
+    }
+}
+
+// Call before changing the text at `byte`.
+// Returns the line start to pass to editor_syntax_lex after the change.
+static I64 editor_syntax_begin_edit(Editor *ed, I64 byte) {
+    I64 line_start = text_line_start(&ed->buf->text, text_line_index(&ed->buf->text, byte));
+    editor_syntax_move_gap(ed, line_start);
+
+    // The range open at the line start is lexed again from before the gap.
+    // A copy after the gap keeps its old end to compare against, its start
+    // may end up before the text but only has to stay before the line.
+    if (ed->buf->syntax_gap != 0) {
+        SyntaxRange open = ed->buf->syntax_lookup[ed->buf->syntax_gap-1];
+        if ((U64)line_start <= open.end) {
+            expect(ed->buf->syntax_range_count < SYNTAX_MAX_RANGE_COUNT);
+            U64 length = (U64)ed->buf->text.length;
+            open.start = length - open.start;
+            open.end = length - open.end;
+            U64 after = SYNTAX_MAX_RANGE_COUNT - ed->buf->syntax_range_count;
+            ed->buf->syntax_lookup[after + ed->buf->syntax_gap - 1] = open;
+            ed->buf->syntax_range_count++;
+        }
+    }
+
+    return line_start;
+}
+
+// Reads the text around a span, for lookahead and lookback past its edges.
+typedef U8 (*SyntaxByteFn)(void *data, I64 byte);
+
+typedef struct SyntaxLexer {
+    SyntaxHighlighting *syntax;
+    ScanSet start_set;
+    ScanSet end_set;
+    bool stop_at_lines;
+
+    // open group and its range, NULL between groups
+    SyntaxGroup *group;
+    SyntaxRange *range;
+
+    // new ranges are written to out, up to out_end
+    SyntaxRange *out;
+    SyntaxRange *out_end;
+
+    SyntaxByteFn byte_at;
+    void *data;
+} SyntaxLexer;
+
+// bytes that can end `group`, plus newlines if asked
+static ScanSet syntax_end_set(SyntaxGroup *group, bool newlines) {
+    ScanSet set = {0};
+    if (group)
+        scan_set_add(&set, group->end_chars[group->end_chars[1] ? 1 : 0]);
+    if (newlines)
+        scan_set_add(&set, '\n');
+    return set;
+}
+
+// Only start characters can open a group, and only the last end character
+// can close one, so scan_find skips everything else. With `stop_at_lines`,
+// newlines are stopped at too.
+static SyntaxLexer syntax_lexer(
+    SyntaxHighlighting *syntax, SyntaxGroup *group, SyntaxRange *range,
+    bool stop_at_lines, SyntaxByteFn byte_at, void *data
+) {
+    SyntaxLexer lx = {
+        .syntax = syntax,
+        .stop_at_lines = stop_at_lines,
+        .group = group,
+        .range = range,
+        .byte_at = byte_at,
+        .data = data,
+    };
+
+    for (U32 c = 0; c < 256; ++c) {
+        if ((syntax->char_is_syntax_start[c >> 6] >> (c & 63)) & 1)
+            scan_set_add(&lx.start_set, (U8)c);
+    }
+    if (stop_at_lines)
+        scan_set_add(&lx.start_set, '\n');
+    lx.end_set = syntax_end_set(group, stop_at_lines);
+    return lx;
+}
+
+static inline U8 syntax_byte(SyntaxLexer *lx, const U8 *ptr, U64 length, I64 base, I64 byte) {
+    if (base <= byte && byte < base + (I64)length)
+        return ptr[byte - base];
+    return lx->byte_at(lx->data, byte);
+}
+
+// Lexes `length` bytes at `ptr`, holding the text from byte `base`.
+// Returns the number of bytes lexed, which is only short of `length`
+// when stopping after a newline.
+static U64 syntax_lex_span(SyntaxLexer *lx, const U8 *ptr, U64 length, I64 base) {
+    U64 offset = 0;
+    while (offset < length) {
+        const ScanSet *set = lx->group ? &lx->end_set : &lx->start_set;
+        offset += scan_find(set, ptr + offset, length - offset);
+        if (offset == length)
+            break;
+
+        I64 i = base + (I64)offset;
+        U8 ch = ptr[offset++];
+
+        if (lx->group == NULL) {
+            U8 ch_next = syntax_byte(lx, ptr, length, base, i+1);
+            U64 group_count = lx->syntax->group_count;
+         
+            for (U64 j = 0; j < group_count; ++j) {
+                SyntaxGroup *group = &lx->syntax->groups[j];
+                U8 *start_chars = group->start_chars;
+                bool match_0 = start_chars[0] == ch;
+                bool match_1 = start_chars[1] == 0 || start_chars[1] == ch_next;
+
+                if (match_0 & match_1) {
+                    expect(lx->out < lx->out_end);
+                    lx->group = group;
+                    lx->range = lx->out++;
+                    lx->range->start = (U64)i;
+                    lx->range->group = (U32)j;
+                    lx->end_set = syntax_end_set(group, lx->stop_at_lines);
+                    break;
+                }
+            }
+        } else {
+            U8 ch_prev = syntax_byte(lx, ptr, length, base, i-1);
+            U8 *end_chars = lx->group->end_chars;
+            bool group_end;
+            I64 end_count;
             if (end_chars[1] == 0) {
-                end = end_chars[0] == ch;
+                group_end = end_chars[0] == ch;
                 end_count = 1;
             } else {
-                end = end_chars[0] == ch_prev && end_chars[1] == ch;
+                group_end = end_chars[0] == ch_prev && end_chars[1] == ch;
                 end_count = 2;
             }
-            
+        
             // If there are an even number of escape characters before
             // the end characters, then they all escape each other. Otherwise,
             // the first end character is escaped, and we do not end this group.
-            U8 escape = current_syntax_group->escape;
-            if (end && escape != 0) {
+            U8 escape = lx->group->escape;
+            if (group_end && escape != 0) {
                 I64 escape_count = 0;
-                while (editor_text(ed, i-end_count-escape_count) == escape)
+                while (syntax_byte(lx, ptr, length, base, i-end_count-escape_count) == escape)
                     escape_count++;
-                end &= (escape_count & 1) == 0; 
+                group_end &= (escape_count & 1) == 0; 
             }
-            
-            if (end) {
-                current_range->end = i;
-                current_range = NULL;
-                current_syntax_group = NULL;
+        
+            if (group_end) {
+                lx->range->end = (U64)i;
+                lx->range = NULL;
+                lx->group = NULL;
             }
         }
+
+        if (ch == '\n' && lx->stop_at_lines)
+            break;
+    }
+    return offset;
+}
+
+static U8 editor_syntax_byte_at(void *data, I64 byte) {
+    return editor_text(data, byte);
+}
+
+// Lexes from the line start `start`, replacing the ranges after the gap.
+// Once past `end`, it stops at the first line start where the state
+// matches the old ranges, as the rest of the text lexes the same as before.
+static void editor_syntax_lex(Editor *ed, I64 start, I64 end) {
+    SyntaxRange *ranges = ed->buf->syntax_lookup;
+    SyntaxGroup *groups = ed->buf->syntax.groups;
+    I64 length = ed->buf->text.length;
+
+    // the last range before the gap may still be open
+    SyntaxGroup *group = NULL;
+    SyntaxRange *range = NULL;
+    if (ed->buf->syntax_gap != 0) {
+        SyntaxRange *last = &ranges[ed->buf->syntax_gap-1];
+        if ((U64)start <= last->end) {
+            range = last;
+            group = &groups[last->group];
+        }
     }
     
-    ed->line_lookup[line_count] = (U32)ed->text_length;
-    ed->syntax_range_count = syntax_range;
-    ed->line_count = line_count;
+    SyntaxLexer lx = syntax_lexer(&ed->buf->syntax, group, range, end < length, editor_syntax_byte_at, ed);
+    lx.out = &ranges[ed->buf->syntax_gap];
+    
+    I64 i = start;
+    while (i < length) {
+        lx.out_end = &ranges[SYNTAX_MAX_RANGE_COUNT - ed->buf->syntax_range_count + ed->buf->syntax_gap];
+
+        TextChunk chunk = text_chunk(&ed->buf->text, i);
+        U64 offset = (U64)(i - chunk.start);
+        i += (I64)syntax_lex_span(&lx, chunk.ptr + offset, (U64)chunk.length - offset, i);
+
+        U32 lexed = (U32)(lx.out - &ranges[ed->buf->syntax_gap]);
+        ed->buf->syntax_gap += lexed;
+        ed->buf->syntax_range_count += lexed;
+
+        if (lx.stop_at_lines && i > end && editor_text(ed, i-1) == '\n') {
+            // drop old ranges that ended before this line
+            SyntaxRange *old = NULL;
+            while (ed->buf->syntax_gap != ed->buf->syntax_range_count) {
+                old = &ranges[SYNTAX_MAX_RANGE_COUNT - ed->buf->syntax_range_count + ed->buf->syntax_gap];
+                if (length - (I64)old->end >= i)
+                    break;
+                ed->buf->syntax_range_count--;
+                old = NULL;
+            }
+
+            // old range open at this line
+            if (old && length - (I64)old->start >= i)
+                old = NULL;
+
+            SyntaxGroup *old_group = old ? &groups[old->group] : NULL;
+            if (old_group == lx.group) {
+                if (lx.range) {
+                    lx.range->end = (U64)length - old->end;
+                    ed->buf->syntax_range_count--;
+                }
+                return;
+            }
+        }
+    }
+
+    // unterminated group runs to the end of the text
+    if (lx.range)
+        lx.range->end = (U64)length;
+    ed->buf->syntax_range_count = ed->buf->syntax_gap;
+}
+
+void editor_remake_caches(Editor *ed) {
+    ed->buf->syntax_range_count = 0;
+    ed->buf->syntax_gap = 0;
+    editor_syntax_lex(ed, 0, ed->buf->text.length);
+}
+
+// BUFFERS ###################################################################
+
+static BufferCache buffer_cache;
+
+static Buffer *buffer_create(void) { TRACE
+    Arena arena = arena_create_sized(16ull * GB);
+    Buffer *buf = arena_alloc(&arena, sizeof(Buffer), alignof(Buffer));
+    *buf = (Buffer) { .arena = arena, .ascii = true, .view_selection_group = Group_Line };
+
+    Arena *a = &buf->arena;
+    buf->undo_stack = undo_create(a);
+    buf->text = text_create(a);
+    buf->syntax_lookup = arena_alloc(a, MAX_SYNTAX_LOOKUP_SIZE, page_size());
+    buf->loader = (EditorLoader) {
+        .slice_newlines = arena_alloc(a, TEXT_MAX_SLICE_COUNT * sizeof(U16), page_size()),
+        .ranges = arena_alloc(a, MAX_SYNTAX_LOOKUP_SIZE, page_size()),
+        .chunk_counted = arena_alloc(a, LOAD_MAX_CHUNK_COUNT, page_size()),
+        .stream_fd = -1,
+    };
+    buf->follow = (EditorFollow) { .inotify_fd = -1, .fd = -1 };
+    buf->watch = -1;
+    buf->saver.spans = arena_alloc(a, (TEXT_MAX_PIECE_COUNT + 1) * sizeof(TextChunk), page_size());
+    buf->saver.disk_spans = arena_alloc(a, (TEXT_MAX_PIECE_COUNT + 1) * sizeof(TextChunk), page_size());
+    buf->saver.hash_marks = arena_alloc(a, SAVE_MAX_HASH_MARK_COUNT * sizeof(UndoHash), page_size());
+    buf->saver.hash_marks[0] = (UndoHash) {0};
+    buf->saver.hash_mark_count = 1;
+    return buf;
+}
+
+static void buffer_destroy(Buffer *buf) { TRACE
+    editor_load_stop(&buf->loader);
+    editor_save_join(&buf->saver);
+    buffer_unwatch(buf);
+    text_clear(&buf->text);
+    undo_history_close(&buf->undo_stack);
+    Arena arena = buf->arena;
+    arena_destroy(&arena);
+}
+
+// roughly what the buffer holds in memory, the file mapping included
+static U64 buffer_memory(Buffer *buf) {
+    Text *t = &buf->text;
+    return t->original_length
+        + t->add_length
+        + t->piece_count * sizeof(Piece)
+        + buf->syntax_range_count * sizeof(SyntaxRange)
+        + undo_memory(&buf->undo_stack);
+}
+
+// Remembers the file as the buffer has it, to tell if it changed since.
+static void buffer_stat_file(Buffer *buf) {
+    struct stat st;
+    if (buf->real_path[0] == 0 || stat(buf->real_path, &st) != 0) {
+        buf->file_inode = 0;
+        return;
+    }
+    buf->file_mtime_ns = (U64)st.st_mtim.tv_sec * 1000000000ull + (U64)st.st_mtim.tv_nsec;
+    buf->file_size = (U64)st.st_size;
+    buf->file_inode = (U64)st.st_ino;
+}
+
+// true if the file isn't as it was last loaded, saved or reloaded
+static bool buffer_file_changed(Buffer *buf) {
+    struct stat st;
+    if (stat(buf->real_path, &st) != 0) return false;
+    return buf->file_inode != (U64)st.st_ino
+        || buf->file_size != (U64)st.st_size
+        || buf->file_mtime_ns != (U64)st.st_mtim.tv_sec * 1000000000ull + (U64)st.st_mtim.tv_nsec;
+}
+
+// Puts the buffer of a file at the front of the list, so views of the file
+// find it.
+static void buffer_list(Buffer *buf) {
+    BufferCache *bc = &buffer_cache;
+    buf->lru_prev = NULL;
+    buf->lru_next = bc->first;
+    if (bc->first) bc->first->lru_prev = buf;
+    else bc->last = buf;
+    bc->first = buf;
+    buf->listed = true;
+}
+
+static void buffer_unlist(Buffer *buf) {
+    if (!buf->listed) return;
+    BufferCache *bc = &buffer_cache;
+    if (buf->lru_prev) buf->lru_prev->lru_next = buf->lru_next;
+    else bc->first = buf->lru_next;
+    if (buf->lru_next) buf->lru_next->lru_prev = buf->lru_prev;
+    else bc->last = buf->lru_prev;
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+    buf->listed = false;
+}
+
+// Evicts the least recently used buffers no view holds past the budget,
+// unsaved ones last.
+static void buffer_cache_trim(void) {
+    BufferCache *bc = &buffer_cache;
+    U64 memory = 0;
+    for (Buffer *buf = bc->first; buf; buf = buf->lru_next) {
+        if (buf->refs == 0)
+            memory += buffer_memory(buf);
+    }
+
+    while (bc->cached_count > BUFFER_CACHE_MAX_COUNT || (bc->cached_count != 0 && memory > BUFFER_CACHE_BUDGET)) {
+        Buffer *victim = NULL;
+        for (Buffer *buf = bc->last; buf; buf = buf->lru_prev) {
+            if (buf->refs != 0) continue;
+            if (victim == NULL) victim = buf;
+            if ((buf->flags & EditorFlag_Unsaved) == 0 && !buf->saver.running) {
+                victim = buf;
+                break;
+            }
+        }
+        memory -= buffer_memory(victim);
+        buffer_unlist(victim);
+        bc->cached_count--;
+        buffer_destroy(victim);
+    }
+}
+
+// Drops a view's hold on the buffer, keeping it in the cache when it was the
+// last one, if it is of a file.
+static void buffer_release(Buffer *buf) { TRACE
+    expect(buf->refs != 0);
+    if (--buf->refs != 0) return;
+
+    editor_follow_stop(&buf->follow);
+    if (!buf->listed || buf->loader.stream_fd >= 0) {
+        buffer_unlist(buf);
+        buffer_destroy(buf);
+        return;
+    }
+
+    buffer_cache.cached_count++;
+    buffer_cache_trim();
+}
+
+// Finds the buffer of the file. One a view holds is shared as is, a cached one
+// is dropped if the file changed since, unless it has unsaved edits.
+static Buffer *buffer_find(const char *real_path) { TRACE
+    for (Buffer *buf = buffer_cache.first; buf; buf = buf->lru_next) {
+        if (strcmp(buf->real_path, real_path) != 0)
+            continue;
+
+        buffer_unlist(buf);
+        if (buf->refs != 0) {
+            buffer_list(buf);
+            return buf;
+        }
+
+        buffer_cache.cached_count--;
+        struct stat st;
+        bool same = stat(real_path, &st) == 0
+            && buf->file_inode == (U64)st.st_ino
+            && buf->file_size == (U64)st.st_size
+            && buf->file_mtime_ns == (U64)st.st_mtim.tv_sec * 1000000000ull + (U64)st.st_mtim.tv_nsec;
+        if (same || (buf->flags & EditorFlag_Unsaved) || buf->saver.running) {
+            buffer_list(buf);
+            return buf;
+        }
+
+        buffer_destroy(buf);
+        return NULL;
+    }
+    return NULL;
+}
+
+// WATCHING ##################################################################
+//
+// The directories of open files are watched for files being written or
+// moved into place, as tools replacing a file tend to write a new one and
+// rename it over. A change is only looked at once no save, load or insert is
+// under way, and the file's stat tells it apart from our own saves.
+
+static int buffer_watch_fd = -1;
+
+static const char *buffer_name(Buffer *buf) {
+    const char *slash = strrchr(buf->real_path, '/');
+    return slash ? slash + 1 : buf->real_path;
+}
+
+static void buffer_watch(Buffer *buf) {
+    if (buffer_watch_fd < 0)
+        buffer_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (buffer_watch_fd < 0) return;
+
+    char dir[PATH_MAX];
+    memcpy(dir, buf->real_path, sizeof(dir));
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) return;
+    slash[slash == dir] = 0;
+    buf->watch = inotify_add_watch(buffer_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+}
+
+// The watch is on the directory, which other buffers may share.
+static void buffer_unwatch(Buffer *buf) {
+    if (buf->watch < 0) return;
+    for (Buffer *other = buffer_cache.first; other; other = other->lru_next) {
+        if (other != buf && other->watch == buf->watch) {
+            buf->watch = -1;
+            return;
+        }
+    }
+    inotify_rm_watch(buffer_watch_fd, buf->watch);
+    buf->watch = -1;
+}
+
+// Marks the buffers of files that were written since the last poll.
+static void buffer_watch_poll(void) {
+    if (buffer_watch_fd < 0) return;
+
+    alignas(struct inotify_event) U8 events[4096];
+    ssize_t length;
+    while ((length = read(buffer_watch_fd, events, sizeof(events))) > 0) {
+        for (ssize_t at = 0; at < length;) {
+            struct inotify_event *event = (struct inotify_event *)(events + at);
+            at += (ssize_t)(sizeof(*event) + event->len);
+
+            // events were lost, so anything may have changed
+            bool overflow = (event->mask & IN_Q_OVERFLOW) != 0;
+            for (Buffer *buf = buffer_cache.first; buf; buf = buf->lru_next) {
+                bool named = event->len && buf->watch == event->wd && strcmp(buffer_name(buf), event->name) == 0;
+                if (overflow || named)
+                    buf->disk_changed = true;
+            }
+        }
+    }
+}
+
+// Makes the text what the file holds now. Only the lines that differ are
+// changed, as one undo group, so the views keep their place around them.
+static void editor_reload(Editor *ed) { TRACE
+    Buffer *buf = ed->buf;
+    Text *t = &buf->text;
+
+    int fd = open(buf->real_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (U64)st.st_size > TEXT_MAX_LENGTH) {
+        close(fd);
+        return;
+    }
+
+    // Written in place, the original buffer may already show some of it, and
+    // may be cut short. Only reading it from scratch is safe then.
+    if ((U64)st.st_ino == buf->saver.mapped_inode) {
+        close(fd);
+        editor_reopen(ed);
+        return;
+    }
+
+    I64 length = (I64)st.st_size;
+    U8 *bytes = NULL;
+    if (length != 0) {
+        bytes = mmap(NULL, (U64)length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ((void*)bytes == MAP_FAILED) {
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+
+    // the lines before the first difference and after the last are kept
+    I64 prefix = text_match_prefix(t, bytes, length);
+    I64 max_suffix = (t->length < length ? t->length : length) - prefix;
+    I64 suffix = text_match_suffix(t, bytes, length, max_suffix);
+    while (prefix > 0 && bytes[prefix-1] != '\n')
+        prefix--;
+    while (suffix > 0 && length - suffix > prefix && bytes[length-suffix-1] != '\n')
+        suffix--;
+
+    I64 a_length = t->length - suffix - prefix;
+    I64 b_length = length - suffix - prefix;
+
+    // a change this big would be copied into the add buffer, reading it is cheaper
+    if (a_length > (I64)RELOAD_DIFF_MAX_LENGTH || b_length > (I64)RELOAD_DIFF_MAX_LENGTH) {
+        if (bytes) munmap(bytes, (U64)length);
+        editor_reopen(ed);
+        return;
+    }
+
+    U8 *a = ARENA_ALLOC_ARRAY(&w->frame_arena, U8, (U64)a_length);
+    text_copy(t, a, prefix, prefix + a_length);
+    U8 *b = bytes + prefix;
+    DiffHunk whole = { 0, (U64)a_length, 0, (U64)b_length };
+    DiffHunk *hunks = &whole;
+    I64 hunk_count = a_length != 0 || b_length != 0;
+
+    // the diff keeps 16 bytes a line, so many short lines are replaced whole
+    bool few_lines = scan_count_newlines(a, (U64)a_length) <= RELOAD_DIFF_MAX_LINES
+                  && scan_count_newlines(b, (U64)b_length) <= RELOAD_DIFF_MAX_LINES;
+    if (few_lines) {
+        I64 count = diff_lines(&w->frame_arena, a, (U64)a_length, b, (U64)b_length, RELOAD_DIFF_MAX_EDITS, &hunks);
+        if (count >= 0)
+            hunk_count = count;
+        else
+            hunks = &whole;
+    }
+
+    // Back to front, so the offsets before each hunk hold. The new lines go
+    // in first, as emptying the text would leave the newline it's kept with.
+    undo_group_begin(&buf->undo_stack);
+    for (I64 i = hunk_count; i != 0; --i) {
+        DiffHunk hunk = hunks[i-1];
+        I64 start = prefix + (I64)hunk.a_start;
+        I64 inserted = (I64)(hunk.b_end - hunk.b_start);
+        editor_text_insert(ed, start, b + hunk.b_start, inserted);
+        editor_text_remove(ed, start + inserted, prefix + (I64)hunk.a_end + inserted);
+    }
+    undo_group_end(&buf->undo_stack);
+    if (bytes) munmap(bytes, (U64)length);
+
+    buf->flags &= ~(U32)EditorFlag_Unsaved;
+    buffer_stat_file(buf);
+
+    // the file holds the text, unless it lacks the final newline
+    EditorSaver *sv = &buf->saver;
+    sv->disk_span_count = t->length == length ? text_snapshot(t, sv->disk_spans) : 0;
+    sv->hash_mark_count = 1;
+}
+
+// Picks up changes to the file made by others. Unsaved edits are never
+// written over, the buffer is marked as in conflict instead.
+static void editor_reload_poll(Editor *ed) {
+    Buffer *buf = ed->buf;
+    if (!buf->disk_changed) return;
+    if (buf->saver.running || buf->loader.running || buf->follow.fd >= 0) return;
+    buf->disk_changed = false;
+    if (!buffer_file_changed(buf)) return;
+
+    if (buf->flags & EditorFlag_Unsaved) {
+        buf->disk_conflict = true;
+    } else {
+        // the reload is undone on its own, typing after it starts a new group
+        editor_insert_end(buf);
+        editor_reload(ed);
+    }
+}
+
+// LOADING ###################################################################
+
+static U8 editor_load_byte_at(void *data, I64 byte) {
+    EditorLoader *ld = data;
+    if (byte < 0 || (U64)byte >= ld->original_length) return '\n';
+    return ld->original[byte];
+}
+
+static U64 editor_load_chunk_count(EditorLoader *ld) {
+    return (ld->original_length + LOAD_CHUNK_SIZE - 1) / LOAD_CHUNK_SIZE;
+}
+
+// Checks whether [start, end) of the original buffer is ASCII, and if not,
+// whether it's UTF-8. A sequence may run on past `end`.
+static void editor_load_check_utf8(EditorLoader *ld, U64 start, U64 end, bool *non_ascii, bool *invalid) {
+    U64 ascii = utf8_ascii_length(ld->original + start, end - start);
+    if (ascii == end - start) return;
+    *non_ascii = true;
+    if (!utf8_valid_range(ld->original, ld->original_length, start + ascii, end))
+        *invalid = true;
+}
+
+// Counts the newlines of each slice in the next unclaimed chunk, and checks
+// its encoding while the slice is in cache.
+// Returns false once every chunk is claimed or loading is cancelled.
+static bool editor_load_count_chunk(EditorLoader *ld) {
+    pthread_mutex_lock(&ld->mutex);
+    bool claimed = !ld->cancel && ld->next_chunk < editor_load_chunk_count(ld);
+    U64 chunk = claimed ? ld->next_chunk++ : 0;
+    pthread_mutex_unlock(&ld->mutex);
+    if (!claimed) return false;
+
+    U64 start = chunk * LOAD_CHUNK_SIZE;
+    U64 end = start + LOAD_CHUNK_SIZE;
+    if (end > ld->original_length) end = ld->original_length;
+    bool non_ascii = false;
+    bool invalid = false;
+    for (U64 at = start; at < end; at += TEXT_PIECE_MAX_LENGTH) {
+        U64 slice_length = end - at;
+        if (slice_length > TEXT_PIECE_MAX_LENGTH) slice_length = TEXT_PIECE_MAX_LENGTH;
+        ld->slice_newlines[at / TEXT_PIECE_MAX_LENGTH] = (U16)scan_count_newlines(ld->original + at, slice_length);
+        editor_load_check_utf8(ld, at, at + slice_length, &non_ascii, &invalid);
+    }
+
+    pthread_mutex_lock(&ld->mutex);
+    ld->non_ascii |= non_ascii;
+    ld->utf8_invalid |= invalid;
+    ld->chunk_counted[chunk] = 1;
+    pthread_cond_broadcast(&ld->counted);
+    pthread_mutex_unlock(&ld->mutex);
+    return true;
+}
+
+static void *editor_count_thread(void *data) {
+    EditorLoader *ld = data;
+    while (editor_load_count_chunk(ld)) {}
+    return NULL;
+}
+
+// Waits until chunk `chunk` is counted, counting later chunks meanwhile.
+// Returns false if loading was cancelled.
+static bool editor_load_wait_counted(EditorLoader *ld, U64 chunk) {
+    pthread_mutex_lock(&ld->mutex);
+    while (!ld->chunk_counted[chunk] && !ld->cancel) {
+        if (ld->next_chunk < editor_load_chunk_count(ld)) {
+            pthread_mutex_unlock(&ld->mutex);
+            editor_load_count_chunk(ld);
+            pthread_mutex_lock(&ld->mutex);
+        } else {
+            pthread_cond_wait(&ld->counted, &ld->mutex);
+        }
+    }
+    bool counted = ld->chunk_counted[chunk];
+    pthread_mutex_unlock(&ld->mutex);
+    return counted;
+}
+
+// Publishes the text up to `indexed` and the ranges lexed up to there.
+// Returns true if loading was cancelled.
+static bool editor_load_publish(EditorLoader *ld, SyntaxLexer *lx, U64 indexed, bool done) {
+    pthread_mutex_lock(&ld->mutex);
+    ld->indexed = indexed;
+    ld->done = done;
+    ld->range_count = (U32)(lx->out - ld->ranges);
+    ld->range_open = lx->range != NULL;
+    bool cancel = ld->cancel;
+    pthread_cond_broadcast(&ld->published);
+    pthread_mutex_unlock(&ld->mutex);
+    return cancel;
+}
+
+static void *editor_load_thread(void *data) {
+    EditorLoader *ld = data;
+    const U8 *original = ld->original;
+    U64 length = ld->original_length;
+    U64 chunk_count = editor_load_chunk_count(ld);
+
+    // this thread counts too, and lexes the chunks as they are counted
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    U64 counter_count = cores > 1 ? (U64)cores - 1 : 0;
+    if (counter_count > LOAD_MAX_THREADS) counter_count = LOAD_MAX_THREADS;
+    if (counter_count > chunk_count - 1) counter_count = chunk_count - 1;
+    ld->counter_count = 0;
+    for (U64 i = 0; i < counter_count; ++i) {
+        if (pthread_create(&ld->counters[i], NULL, editor_count_thread, ld) != 0)
+            break;
+        ld->counter_count++;
+    }
+
+    SyntaxLexer lx = syntax_lexer(&ld->syntax, NULL, NULL, false, editor_load_byte_at, ld);
+    lx.out = ld->ranges;
+    lx.out_end = ld->ranges + SYNTAX_MAX_RANGE_COUNT;
+
+    U64 lexed = 0;
+    bool cancel = false;
+    for (U64 chunk = 0; !cancel && lexed < length; ++chunk) {
+        if (!editor_load_wait_counted(ld, chunk))
+            break;
+        U64 counted = (chunk + 1) * LOAD_CHUNK_SIZE;
+        if (counted > length) counted = length;
+        if (ld->hash_content)
+            undo_hash_update(&ld->hash, original + chunk * LOAD_CHUNK_SIZE, counted - chunk * LOAD_CHUNK_SIZE);
+
+        // publish up to the last newline, so the text stays newline terminated
+        U64 boundary = counted;
+        if (boundary != length) {
+            while (boundary > lexed && original[boundary-1] != '\n')
+                boundary--;
+            if (boundary == lexed)
+                boundary = counted;
+        }
+
+        syntax_lex_span(&lx, original + lexed, boundary - lexed, (I64)lexed);
+        lexed = boundary;
+        cancel = editor_load_publish(ld, &lx, lexed, lexed == length);
+    }
+
+    for (U32 i = 0; i < ld->counter_count; ++i)
+        pthread_join(ld->counters[i], NULL);
+    return NULL;
+}
+
+// Reads a stream into the original buffer until it ends, publishing whole
+// lines as they arrive. The length the lexer sees grows with each read.
+static void *editor_stream_thread(void *data) {
+    EditorLoader *ld = data;
+    U8 *original = ld->original;
+
+    SyntaxLexer lx = syntax_lexer(&ld->syntax, NULL, NULL, false, editor_load_byte_at, ld);
+    lx.out = ld->ranges;
+    lx.out_end = ld->ranges + SYNTAX_MAX_RANGE_COUNT;
+
+    U64 length = 0;
+    U64 counted = 0;
+    U64 lexed = 0;
+    bool done = false;
+    bool cancel = false;
+    bool non_ascii = false;
+    bool invalid = false;
+    while (!cancel && !done) {
+        // wake up now and then to check for cancelling
+        struct pollfd pfd = { .fd = ld->stream_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR)
+            done = true;
+
+        if (ready > 0) {
+            U64 space = TEXT_MAX_LENGTH - length;
+            if (space > LOAD_CHUNK_SIZE) space = LOAD_CHUNK_SIZE;
+            ssize_t read_length = space ? read(ld->stream_fd, original + length, space) : 0;
+            if (read_length > 0)
+                length += (U64)read_length;
+            else if (read_length == 0 || (errno != EINTR && errno != EAGAIN))
+                done = true;
+        }
+
+        for (; counted + TEXT_PIECE_MAX_LENGTH <= length; counted += TEXT_PIECE_MAX_LENGTH)
+            ld->slice_newlines[counted / TEXT_PIECE_MAX_LENGTH] = (U16)scan_count_newlines(original + counted, TEXT_PIECE_MAX_LENGTH);
+        ld->original_length = length;
+
+        // a line may still be arriving until the stream ends
+        U64 boundary = length;
+        if (!done) {
+            while (boundary > lexed && original[boundary-1] != '\n')
+                boundary--;
+            if (boundary == lexed) {
+                pthread_mutex_lock(&ld->mutex);
+                cancel = ld->cancel;
+                pthread_mutex_unlock(&ld->mutex);
+                continue;
+            }
+        }
+
+        // whole lines, so no sequence runs past the boundary
+        editor_load_check_utf8(ld, lexed, boundary, &non_ascii, &invalid);
+        syntax_lex_span(&lx, original + lexed, boundary - lexed, (I64)lexed);
+        lexed = boundary;
+        cancel = editor_load_publish(ld, &lx, lexed, done);
+    }
+
+    pthread_mutex_lock(&ld->mutex);
+    ld->non_ascii = non_ascii;
+    ld->utf8_invalid = invalid;
+    pthread_mutex_unlock(&ld->mutex);
+    return NULL;
+}
+
+// Starts `worker` on the text's original buffer.
+static void editor_load_run(Editor *ed, void *(*worker)(void *)) {
+    EditorLoader *ld = &ed->buf->loader;
+    ld->cancel = false;
+    ld->done = false;
+    ld->indexed = 0;
+    ld->range_count = 0;
+    ld->range_open = false;
+    ld->next_chunk = 0;
+    ld->syntax = ed->buf->syntax;
+    ld->original = ed->buf->text.original;
+    ld->original_length = ed->buf->text.original_length;
+    ld->absorbed_ranges = 0;
+    ld->absorbed_open = false;
+    ld->non_ascii = false;
+    ld->utf8_invalid = false;
+    ld->hash = (UndoHash) {0};
+    memset(ld->chunk_counted, 0, editor_load_chunk_count(ld));
+    ed->buf->ascii = false;
+
+    expect(pthread_mutex_init(&ld->mutex, NULL) == 0);
+    expect(pthread_cond_init(&ld->published, NULL) == 0);
+    expect(pthread_cond_init(&ld->counted, NULL) == 0);
+    expect(pthread_create(&ld->thread, NULL, worker, ld) == 0);
+    ld->running = true;
+}
+
+// Starts indexing the text's original buffer, which must be opened and empty.
+static void editor_load_start(Editor *ed) { TRACE
+    EditorLoader *ld = &ed->buf->loader;
+    expect(!ld->running);
+    if (ed->buf->text.original_length == 0) {
+        UndoHash empty = {0};
+        editor_history_open(ed, &empty, 0);
+        return;
+    }
+
+    ld->stream_fd = -1;
+    editor_load_run(ed, editor_load_thread);
+}
+
+// Starts reading `fd` into the text, which must be empty.
+// The fd is closed once the stream ends or loading is stopped.
+static void editor_stream_start(Editor *ed, int fd) { TRACE
+    EditorLoader *ld = &ed->buf->loader;
+    expect(!ld->running);
+    if (text_open_stream(&ed->buf->text) == NULL) {
+        fprintf(stderr, "Error reading stream: Could not map buffer\n");
+        close(fd);
+        return;
+    }
+
+    ld->stream_fd = fd;
+    ld->hash_content = false;
+    editor_load_run(ed, editor_stream_thread);
+}
+
+static void editor_load_join(EditorLoader *ld) {
+    pthread_join(ld->thread, NULL);
+    if (ld->stream_fd >= 0) {
+        close(ld->stream_fd);
+        ld->stream_fd = -1;
+    }
+    pthread_cond_destroy(&ld->counted);
+    pthread_cond_destroy(&ld->published);
+    pthread_mutex_destroy(&ld->mutex);
+    ld->running = false;
+}
+
+// Stops the worker, leaving the text partially loaded.
+static void editor_load_stop(EditorLoader *ld) { TRACE
+    if (!ld->running) return;
+
+    pthread_mutex_lock(&ld->mutex);
+    ld->cancel = true;
+    pthread_mutex_unlock(&ld->mutex);
+    editor_load_join(ld);
+}
+
+// Everything was read, so whether the text is ASCII is known, and what it
+// hashed to. Edits made meanwhile are in the add buffer.
+static void editor_load_finish(Editor *ed) {
+    EditorLoader *ld = &ed->buf->loader;
+    editor_load_join(ld);
+    Text *t = &ed->buf->text;
+    ed->buf->ascii = !ld->non_ascii && utf8_ascii_length(t->add, t->add_length) == t->add_length;
+    ed->buf->utf8_invalid = ld->utf8_invalid;
+    if (ld->hash_content)
+        editor_history_open(ed, &ld->hash, ld->original_length);
+}
+
+// Appends whatever the worker has published to the text and syntax ranges.
+static void editor_load_poll(Editor *ed) {
+    EditorLoader *ld = &ed->buf->loader;
+    if (!ld->running) return;
+
+    pthread_mutex_lock(&ld->mutex);
+    U64 indexed = ld->indexed;
+    bool done = ld->done;
+    U32 range_count = ld->range_count;
+    bool range_open = ld->range_open;
+    pthread_mutex_unlock(&ld->mutex);
+
+    Text *t = &ed->buf->text;
+    if (indexed == t->original_loaded) {
+        if (done) editor_load_finish(ed);
+        return;
+    }
+
+    // Edits only happen in the loaded text, so the worker's offsets
+    // are off by however much they grew or shrunk it.
+    I64 old_length = t->length;
+    I64 delta = old_length - (I64)t->original_loaded;
+    editor_syntax_move_gap(ed, old_length);
+    text_append_original(t, indexed, ld->slice_newlines);
+    I64 length = t->length;
+
+    SyntaxRange *ranges = ed->buf->syntax_lookup;
+    SyntaxRange *last = ed->buf->syntax_gap ? &ranges[ed->buf->syntax_gap-1] : NULL;
+    bool open = last && last->end >= (U64)old_length;
+    I64 group = open ? (I64)last->group : -1;
+    I64 loaded_group = ld->absorbed_open ? (I64)ld->ranges[ld->absorbed_ranges-1].group : -1;
+
+    if (group == loaded_group) {
+        if (open) {
+            bool still_open = range_open && ld->absorbed_ranges == range_count;
+            SyntaxRange *loaded = &ld->ranges[ld->absorbed_ranges-1];
+            last->end = still_open ? (U64)length : (U64)((I64)loaded->end + delta);
+        }
+
+        for (U32 j = ld->absorbed_ranges; j < range_count; ++j) {
+            expect(ed->buf->syntax_range_count < SYNTAX_MAX_RANGE_COUNT);
+            SyntaxRange range = ld->ranges[j];
+            bool still_open = range_open && j == range_count-1;
+            range.start = (U64)((I64)range.start + delta);
+            range.end = still_open ? (U64)length : (U64)((I64)range.end + delta);
+            ranges[ed->buf->syntax_gap++] = range;
+            ed->buf->syntax_range_count++;
+        }
+    } else {
+        // an edit changed what the new text starts in, so lex it here
+        editor_syntax_lex(ed, old_length, length);
+    }
+
+    ld->absorbed_ranges = range_count;
+    ld->absorbed_open = range_open;
+
+    if (done)
+        editor_load_finish(ed);
+}
+
+// Waits until line `line` is loaded, or the whole file is.
+// Streams may never get there, so they are not waited on.
+void editor_load_wait(Editor *ed, I64 line) { TRACE
+    EditorLoader *ld = &ed->buf->loader;
+    if (ld->stream_fd >= 0) return;
+    while (ld->running && text_line_count(&ed->buf->text) - 1 <= line) {
+        pthread_mutex_lock(&ld->mutex);
+        while (ld->indexed == ed->buf->text.original_loaded && !ld->done)
+            pthread_cond_wait(&ld->published, &ld->mutex);
+        pthread_mutex_unlock(&ld->mutex);
+        editor_load_poll(ed);
+    }
+}
+
+// SAVING ####################################################################
+
+static const char *editor_save_err(int err) {
+    if (err == -1) return "Save failed: could not create the file";
+    if (err == -2) return "Save failed: could not write the file";
+    if (err == -3) return "Save failed: could not sync the file";
+    if (err == -4) return "Save failed: could not close the file";
+    if (err == -5) return "Save failed: could not replace the file";
+    return "Save failed";
+}
+
+// Feeds the bytes of the text in [start, end) to `hs`, keeping its state at
+// every SAVE_HASH_STRIDE bytes, and writes them to `fd` unless it is -1.
+// Without `hs` they are only written.
+// returns 0 on success
+static int editor_save_spans(EditorSaver *sv, int fd, UndoHash *hs, U64 start, U64 end) {
+    U64 lo = 0;
+    U64 hi = sv->span_count;
+    while (lo < hi) {
+        U64 mid = (lo + hi) / 2;
+        if ((U64)(sv->spans[mid].start + sv->spans[mid].length) <= start) lo = mid + 1;
+        else hi = mid;
+    }
+
+    U64 at = start;
+    for (U64 i = lo; at < end; ++i) {
+        TextChunk span = sv->spans[i];
+        U64 span_end = (U64)(span.start + span.length);
+        if (span_end > end) span_end = end;
+
+        while (at < span_end) {
+            U64 length = span_end - at;
+            if (length > SAVE_WRITE_SIZE) length = SAVE_WRITE_SIZE;
+            U64 next_mark = (at / SAVE_HASH_STRIDE + 1) * SAVE_HASH_STRIDE;
+            if (at + length > next_mark) length = next_mark - at;
+
+            const U8 *ptr = span.ptr + (at - (U64)span.start);
+            if (fd >= 0) {
+                ssize_t written = write(fd, ptr, length);
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) return -2;
+                length = (U64)written;
+
+                pthread_mutex_lock(&sv->mutex);
+                sv->written += length;
+                pthread_mutex_unlock(&sv->mutex);
+            }
+
+            at += length;
+            if (hs) {
+                undo_hash_update(hs, ptr, length);
+                if (at % SAVE_HASH_STRIDE == 0) {
+                    sv->hash_marks[at / SAVE_HASH_STRIDE] = *hs;
+                    sv->hash_mark_count = at / SAVE_HASH_STRIDE + 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Copies the first `length` bytes of the old file to the new one in the
+// kernel, which shares the blocks where the filesystem can. Falls back to
+// writing them from the text, which holds the same bytes.
+// returns 0 on success
+static int editor_save_copy(EditorSaver *sv, int from_fd, int to_fd, U64 length) {
+    long long from_offset = 0;
+    long long to_offset = 0;
+    while ((U64)to_offset < length) {
+        U64 remaining = length - (U64)to_offset;
+        long copied = syscall(SYS_copy_file_range, from_fd, &from_offset, to_fd, &to_offset, remaining, 0u);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) {
+            if (lseek(to_fd, (off_t)to_offset, SEEK_SET) < 0) return -2;
+            return editor_save_spans(sv, to_fd, NULL, (U64)to_offset, length);
+        }
+
+        pthread_mutex_lock(&sv->mutex);
+        sv->written += (U64)copied;
+        pthread_mutex_unlock(&sv->mutex);
+    }
+
+    // the copy leaves the file offset where it was
+    if (lseek(to_fd, (off_t)length, SEEK_SET) < 0) return -2;
+    return 0;
+}
+
+// Writes the spans to a temporary file, then renames it over the path,
+// or over the old bytes of a large file the text doesn't map.
+// returns 0 on success
+static int editor_save_write(EditorSaver *sv) {
+    // replace the file a symlink points to, not the symlink
+    char path[PATH_MAX];
+    if (realpath(sv->path, path) == NULL)
+        memcpy(path, sv->path, sizeof(path));
+
+    char temp_path[PATH_MAX + 16];
+    snprintf(temp_path, sizeof(temp_path), "%s.edit-tmp", path);
+
+    // the start can only be kept from a file no one else wrote since
+    U64 unchanged = sv->unchanged;
+    int old_fd = unchanged ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat st;
+    if (old_fd >= 0) {
+        bool same = fstat(old_fd, &st) == 0
+            && sv->disk_inode == (U64)st.st_ino
+            && sv->disk_size == (U64)st.st_size
+            && sv->disk_mtime_ns == (U64)st.st_mtim.tv_sec * 1000000000ull + (U64)st.st_mtim.tv_nsec;
+        if (!same) {
+            close(old_fd);
+            old_fd = -1;
+        }
+    }
+    if (old_fd < 0) unchanged = 0;
+
+    // A large file is rewritten from the first change on, unless the text
+    // maps it or it has other names. A crash can leave it half written, so
+    // smaller ones are always replaced whole.
+    bool in_place = unchanged >= SAVE_IN_PLACE_MIN
+        && (U64)st.st_ino != sv->mapped_inode
+        && st.st_nlink == 1;
+    int fd = in_place ? open(path, O_WRONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        in_place = false;
+        fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        if (old_fd >= 0) close(old_fd);
+        return -1;
+    }
+
+    // keep the permissions of the file being replaced
+    if (!in_place && stat(path, &st) == 0)
+        (void)fchmod(fd, st.st_mode & 07777);
+
+    // the bytes kept are only hashed from the last mark before them
+    U64 mark = unchanged / SAVE_HASH_STRIDE;
+    if (mark >= sv->hash_mark_count) mark = sv->hash_mark_count - 1;
+    UndoHash hs = sv->hash_marks[mark];
+    int err = editor_save_spans(sv, -1, &hs, mark * SAVE_HASH_STRIDE, unchanged);
+    if (err == 0 && in_place) {
+        if (lseek(fd, (off_t)unchanged, SEEK_SET) < 0) err = -2;
+        pthread_mutex_lock(&sv->mutex);
+        sv->written += unchanged;
+        pthread_mutex_unlock(&sv->mutex);
+    } else if (err == 0 && unchanged) {
+        err = editor_save_copy(sv, old_fd, fd, unchanged);
+    }
+    if (err == 0)
+        err = editor_save_spans(sv, fd, &hs, unchanged, sv->length);
+    if (err == 0 && in_place && ftruncate(fd, (off_t)sv->length) != 0)
+        err = -2;
+    if (old_fd >= 0) close(old_fd);
+    if (err) {
+        close(fd);
+        if (!in_place) remove(temp_path);
+        return err;
+    }
+    sv->hash = undo_hash_final(&hs);
+
+    if (fsync(fd) != 0) {
+        close(fd);
+        if (!in_place) remove(temp_path);
+        return -3;
+    }
+
+    if (close(fd) != 0) {
+        if (!in_place) remove(temp_path);
+        return -4;
+    }
+    if (in_place) return 0;
+
+    if (rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return -5;
+    }
+
+    // the rename is only durable once the directory is synced
+    char *slash = strrchr(path, '/');
+    if (slash) {
+        slash[slash == path] = 0;
+        int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            (void)fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    return 0;
+}
+
+static void *editor_save_thread(void *data) {
+    EditorSaver *sv = data;
+    int err = editor_save_write(sv);
+
+    pthread_mutex_lock(&sv->mutex);
+    sv->err = err;
+    sv->done = true;
+    pthread_mutex_unlock(&sv->mutex);
+    return NULL;
+}
+
+// Returns how many bytes at the start of the snapshot the file already holds,
+// from where its spans point to the same bytes as those of the last save.
+static U64 editor_save_unchanged(EditorSaver *sv) {
+    U64 i = 0;
+    U64 j = 0;
+    U64 at = 0;
+    while (i < sv->span_count && j < sv->disk_span_count) {
+        TextChunk a = sv->spans[i];
+        TextChunk b = sv->disk_spans[j];
+        if (a.ptr + (at - (U64)a.start) != b.ptr + (at - (U64)b.start))
+            break;
+
+        U64 a_end = (U64)(a.start + a.length);
+        U64 b_end = (U64)(b.start + b.length);
+        at = a_end < b_end ? a_end : b_end;
+        if (at == a_end) i++;
+        if (at == b_end) j++;
+    }
+    return at;
+}
+
+// Starts saving the text as it is now, the rest of the file included if it
+// is still loading. Edits made meanwhile mark the buffer unsaved again.
+static void editor_save_start(Editor *ed) { TRACE
+    Buffer *buf = ed->buf;
+    EditorSaver *sv = &buf->saver;
+    if (buf->filepath == NULL) return;
+    if (sv->running) {
+        sv->again = true;
+        return;
+    }
+
+    sv->span_count = text_snapshot(&buf->text, sv->spans);
+    TextChunk *last = sv->span_count ? &sv->spans[sv->span_count-1] : NULL;
+    sv->length = last ? (U64)(last->start + last->length) : 0;
+    sv->unchanged = buf->file_inode ? editor_save_unchanged(sv) : 0;
+    sv->disk_inode = buf->file_inode;
+    sv->disk_size = buf->file_size;
+    sv->disk_mtime_ns = buf->file_mtime_ns;
+    U64 marks = sv->unchanged / SAVE_HASH_STRIDE + 1;
+    if (sv->hash_mark_count > marks) sv->hash_mark_count = marks;
+    sv->hash_marks_kept = sv->hash_mark_count;
+    memcpy(sv->path, buf->filepath, buf->filepath_length + 1);
+    sv->again = false;
+    sv->written = 0;
+    sv->done = false;
+    sv->err = 0;
+    sv->error = NULL;
+
+    expect(pthread_mutex_init(&sv->mutex, NULL) == 0);
+    expect(pthread_create(&sv->thread, NULL, editor_save_thread, sv) == 0);
+    sv->running = true;
+    buf->flags &= ~(U32)EditorFlag_Unsaved;
+}
+
+// Waits for the worker to finish its save.
+static void editor_save_join(EditorSaver *sv) {
+    if (!sv->running) return;
+    pthread_join(sv->thread, NULL);
+    pthread_mutex_destroy(&sv->mutex);
+    sv->running = false;
+}
+
+// Takes the result of the save once it is done.
+static void editor_save_poll(Editor *ed) {
+    Buffer *buf = ed->buf;
+    EditorSaver *sv = &buf->saver;
+    if (!sv->running) return;
+
+    pthread_mutex_lock(&sv->mutex);
+    bool done = sv->done;
+    pthread_mutex_unlock(&sv->mutex);
+    if (!done) return;
+    editor_save_join(sv);
+
+    if (sv->err) {
+        sv->error = editor_save_err(sv->err);
+        sv->hash_mark_count = sv->hash_marks_kept;
+        buf->flags |= EditorFlag_Unsaved;
+        return;
+    }
+
+    // the file holds the snapshot now
+    buf->disk_conflict = false;
+    TextChunk *disk_spans = sv->disk_spans;
+    sv->disk_spans = sv->spans;
+    sv->disk_span_count = sv->span_count;
+    sv->spans = disk_spans;
+    buffer_stat_file(buf);
+
+    // the history only matches the file if nothing was edited since
+    if ((buf->flags & EditorFlag_Unsaved) == 0)
+        editor_history_save(ed, sv->hash, sv->length);
+    else if (sv->again)
+        editor_save_start(ed);
+}
+
+// Lets the saves still running finish, before exiting.
+void editor_save_wait_all(void) { TRACE
+    for (Buffer *buf = buffer_cache.first; buf; buf = buf->lru_next)
+        editor_save_join(&buf->saver);
+}
+
+// FOLLOWING #################################################################
+
+// returns the start of the last line with text on it
+static I64 editor_follow_last_line(Editor *ed) {
+    Text *t = &ed->buf->text;
+    return text_line_start(t, text_line_index(t, t->length - 1));
+}
+
+static void editor_follow_select_end(Editor *ed) {
+    I64 last_line = editor_follow_last_line(ed);
+    editor_set_selection(ed, last_line, editor_group(ed, Group_Line, last_line).end);
+}
+
+// Starts watching the open file for appends and moves to the last line.
+// The text must hold what the file does, so unsaved edits and changes
+// others made and not yet picked up keep it from starting.
+static void editor_follow_start(Editor *ed) { TRACE
+    if (ed->buf->follow.fd >= 0 || ed->buf->real_path[0] == 0) return;
+
+    // the watch may not have seen a change yet
+    editor_load_wait(ed, INT64_MAX);
+    if (buffer_file_changed(ed->buf))
+        ed->buf->disk_changed = true;
+    editor_reload_poll(ed);
+    Buffer *buf = ed->buf; // a reload may have reopened it
+    if (buf->disk_changed || (buf->flags & EditorFlag_Unsaved)) return;
+
+    EditorFollow *fl = &buf->follow;
+    int fd = open((const char*)buf->filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        close(fd);
+        return;
+    }
+    if (inotify_add_watch(inotify_fd, (const char*)buf->filepath, IN_MODIFY) < 0) {
+        close(inotify_fd);
+        close(fd);
+        return;
+    }
+
+    // the file as last loaded, saved or reloaded
+    U8 last = '\n';
+    if (buf->file_size != 0 && pread(fd, &last, 1, (off_t)(buf->file_size - 1)) != 1) {
+        close(inotify_fd);
+        close(fd);
+        return;
+    }
+
+    fl->fd = fd;
+    fl->inotify_fd = inotify_fd;
+    fl->size = buf->file_size;
+    fl->terminated = last == '\n';
+    fl->pending = true;
+
+    editor_follow_select_end(ed);
+}
+
+static void editor_follow_stop(EditorFollow *fl) { TRACE
+    if (fl->fd < 0) return;
+    close(fl->inotify_fd);
+    close(fl->fd);
+    fl->inotify_fd = -1;
+    fl->fd = -1;
+}
+
+// Appends bytes written to the end of the file.
+// The text's final newline may have been added by an edit, in which case
+// the bytes continue the unterminated last line of the file before it.
+static void editor_follow_append(Editor *ed, U8 *bytes, I64 length) {
+    EditorFollow *fl = &ed->buf->follow;
+    Text *t = &ed->buf->text;
+
+    // views stay on the last line unless their selection was moved off it
+    U32 view_count = 0;
+    for (Editor *view = ed->buf->views; view; view = view->view_next)
+        view_count++;
+    bool *pinned = ARENA_ALLOC_ARRAY(&w->frame_arena, bool, view_count);
+    I64 last_line = editor_follow_last_line(ed);
+    U32 i = 0;
+    for (Editor *view = ed->buf->views; view; view = view->view_next)
+        pinned[i++] = view->mode == Mode_Normal && view->selection_b >= last_line;
+
+    bool added = !fl->terminated && t->length != 0 && editor_text(ed, t->length-1) == '\n';
+    editor_text_insert_raw(ed, added ? t->length-1 : t->length, bytes, length);
+    fl->terminated = bytes[length-1] == '\n';
+    if (added && fl->terminated)
+        editor_text_remove_raw(ed, t->length-1, t->length);
+
+    i = 0;
+    for (Editor *view = ed->buf->views; view; view = view->view_next) {
+        if (pinned[i++])
+            editor_follow_select_end(view);
+    }
+}
+
+// Reads what was appended to the file since the last poll.
+// Only the new bytes are read, the syntax is relexed from the last line.
+static void editor_follow_poll(Editor *ed) {
+    EditorFollow *fl = &ed->buf->follow;
+    if (fl->fd < 0 || ed->buf->loader.running) return;
+
+    // the events only say that the file changed
+    bool changed = fl->pending;
+    U8 events[4096];
+    while (read(fl->inotify_fd, events, sizeof(events)) > 0)
+        changed = true;
+    if (!changed) return;
+    fl->pending = false;
+
+    struct stat st;
+    if (fstat(fl->fd, &st) != 0) return;
+    U64 size = (U64)st.st_size;
+
+    if (size < fl->size) {
+        // truncated, probably rotated in place
+        editor_follow_stop(fl);
+        if (!(ed->buf->flags & EditorFlag_Unsaved)) {
+            editor_reopen(ed);
+            editor_follow_start(ed);
+        }
+        return;
+    }
+
+    U64 length = size - fl->size;
+    if (length == 0) return;
+
+    // appends are copied into the add buffer, which would fill up
+    if (ed->buf->text.add_length + length > FOLLOW_MAX_ADD_LENGTH) {
+        editor_follow_stop(fl);
+        if (!(ed->buf->flags & EditorFlag_Unsaved)) {
+            editor_reopen(ed);
+            editor_follow_start(ed);
+        }
+        return;
+    }
+
+    if (length > FOLLOW_READ_SIZE) {
+        length = FOLLOW_READ_SIZE;
+        fl->pending = true;
+        w->force_update = true;
+    }
+
+    U8 *bytes = ARENA_ALLOC_ARRAY(&w->frame_arena, U8, length);
+    ssize_t read_length = pread(fl->fd, bytes, length, (off_t)fl->size);
+    if (read_length <= 0) return;
+
+    editor_follow_append(ed, bytes, (I64)read_length);
+    fl->size += (U64)read_length;
+
+    // the file as it is in the text, a reload picks up anything past it
+    Buffer *buf = ed->buf;
+    buf->file_size = fl->size;
+    buf->file_mtime_ns = (U64)st.st_mtim.tv_sec * 1000000000ull + (U64)st.st_mtim.tv_nsec;
 }
 
 Range editor_range_trim(Editor *ed, Range range) {
@@ -1780,77 +3837,641 @@ void editor_selection_trim(Editor *ed) { TRACE
 }
 
 // UNDO REDO ####################################################################
+//
+// An insert session is one undo group, so it is undone at once, and its
+// typing and deleting coalesce into a few elements as it goes. The group is
+// open on the buffer's shared stack, so only one view holds it at a time,
+// and it is closed when that view loses focus or another view edits.
+
+static void editor_insert_start(Editor *ed, I64 cursor) {
+    ed->mode = Mode_Insert;
+    ed->insert_cursor = cursor;
+    editor_insert_sync(ed);
+}
 
-void editor_undo(Editor *ed) { TRACE
-    UndoStack *st = &ed->undo_stack;
-    if (st->undo_stack_head == 0) return;
+// Opens or ends the view's insert group to match its mode, however the mode
+// was changed or the group was closed.
+static void editor_insert_sync(Editor *ed) {
+    Buffer *buf = ed->buf;
+    if (ed->mode == Mode_Insert && buf->insert_view != ed) {
+        editor_insert_yield(ed);
+        undo_group_begin(&buf->undo_stack);
+        buf->insert_view = ed;
+    } else if (ed->mode != Mode_Insert && buf->insert_view == ed) {
+        editor_insert_end(buf);
+    }
+}
 
-    UndoElem elem = st->undo_stack[--st->undo_stack_head];
-    st->text_stack_head -= elem.text_length;
-    U8 *text = st->text_stack + st->text_stack_head;
+static void editor_insert_end(Buffer *buf) {
+    if (buf->insert_view == NULL) return;
+    undo_group_end(&buf->undo_stack);
+    buf->insert_view = NULL;
+}
 
-    switch (elem.op) {
-        case UndoOp_Insert:
-            editor_text_remove_raw(ed, elem.at, elem.at + (I64)elem.text_length);
-            editor_set_selection(ed, elem.at, elem.at);
-            break;
-        case UndoOp_Remove:
-            editor_text_insert_raw(ed, elem.at, text, (I64)elem.text_length);
-            editor_set_selection(ed, elem.at, elem.at + elem.text_length);
-            break;
+// ends another view's insert group before this view records an edit
+static void editor_insert_yield(Editor *ed) {
+    if (ed->buf->insert_view != ed)
+        editor_insert_end(ed->buf);
+}
+
+// Returns the recorded text at a stream offset, unpacking its block if it
+// has gone cold. Valid until the next undo call.
+static U8 *undo_text(UndoStack *st, U64 offset) {
+    if (offset >= st->hot_start)
+        return st->text_stack + (offset - st->hot_start);
+
+    U32 lo = 0;
+    U32 hi = st->block_count;
+    while (hi - lo > 1) {
+        U32 mid = (lo + hi) / 2;
+        if (st->blocks[mid].stream_start <= offset) lo = mid;
+        else hi = mid;
+    }
+    UndoBlock *block = &st->blocks[lo];
+    expect(block->stream_start <= offset && offset < block->stream_start + block->raw_length);
+
+    if (st->thawed_start != block->stream_start) {
+        bool ok = lz_decompress(st->packed + block->packed_start, block->packed_length, st->thawed, block->raw_length);
+        expect(ok);
+        st->thawed_start = block->stream_start;
+    }
+    return st->thawed + (offset - block->stream_start);
+}
+
+// Steps the head back over one element, from the history file once the
+// elements in memory run out. Returns the element and, if undoing it puts
+// text back, that text. Returns false at the start of the history.
+static bool undo_step_back(UndoStack *st, UndoElem *elem, U8 **text) {
+    if (st->undo_stack_head != 0) {
+        *elem = st->undo_stack[--st->undo_stack_head];
+        st->text_stack_head -= elem->text_length;
+        *text = elem->op == UndoOp_Remove ? undo_text(st, st->text_stack_head) : NULL;
+        return true;
+    }
+    if (st->disk_head == 0) return false;
+
+    U64 end = st->disk_head_offset;
+    U64 record_length;
+    memcpy(&record_length, st->disk_map + end - sizeof(U64), sizeof(U64));
+    if (record_length < sizeof(UndoElem) + sizeof(U64) || record_length > end - sizeof(UndoHistoryHeader)) {
+        undo_clear(st);
+        return false;
+    }
+    U64 start = end - record_length;
+    memcpy(elem, st->disk_map + start, sizeof(UndoElem));
+    if (sizeof(UndoElem) + elem->text_length + sizeof(U64) != record_length) {
+        undo_clear(st);
+        return false;
+    }
+
+    st->disk_head--;
+    st->disk_head_offset = start;
+    *text = elem->op == UndoOp_Remove ? st->disk_map + start + sizeof(UndoElem) : NULL;
+    return true;
+}
+
+// The same forward, only taking a joined element if `joined_only`.
+static bool undo_step_forward(UndoStack *st, UndoElem *elem, U8 **text, bool joined_only) {
+    if (st->disk_head < st->disk_base) {
+        U64 start = st->disk_head_offset;
+        U64 space = st->disk_base_offset - start;
+        if (space < sizeof(UndoElem) + sizeof(U64)) {
+            undo_clear(st);
+            return false;
+        }
+        memcpy(elem, st->disk_map + start, sizeof(UndoElem));
+        U64 record_length = sizeof(UndoElem) + elem->text_length + sizeof(U64);
+        if (record_length > space) {
+            undo_clear(st);
+            return false;
+        }
+        if (joined_only && !elem->joined) return false;
+
+        st->disk_head++;
+        st->disk_head_offset += record_length;
+        *text = elem->op == UndoOp_Insert ? st->disk_map + start + sizeof(UndoElem) : NULL;
+        return true;
+    }
+
+    if (st->undo_stack_head == st->undo_count) return false;
+    if (joined_only && !st->undo_stack[st->undo_stack_head].joined) return false;
+    *elem = st->undo_stack[st->undo_stack_head++];
+    *text = elem->op == UndoOp_Insert ? undo_text(st, st->text_stack_head) : NULL;
+    st->text_stack_head += elem->text_length;
+    return true;
+}
+
+// undoes the last element and the ones joined to it
+void editor_undo(Editor *ed) { TRACE
+    UndoStack *st = &ed->buf->undo_stack;
+    UndoElem elem;
+    U8 *text;
+    bool undone = false;
+    while (undo_step_back(st, &elem, &text)) {
+        switch (elem.op) {
+            case UndoOp_Insert:
+                editor_text_remove_raw(ed, elem.at, elem.at + (I64)elem.text_length);
+                editor_set_selection(ed, elem.at, elem.at);
+                break;
+            case UndoOp_Remove:
+                editor_text_insert_raw(ed, elem.at, text, (I64)elem.text_length);
+                editor_set_selection(ed, elem.at, elem.at + elem.text_length);
+                break;
+        }
+        undone = true;
+        if (!elem.joined) break;
     }
     
-    ed->flags |= EditorFlag_Unsaved;
+    if (undone)
+        ed->buf->flags |= EditorFlag_Unsaved;
 }
 
+// redoes the next element and the ones joined to it
 void editor_redo(Editor *ed) { TRACE
-    UndoStack *st = &ed->undo_stack;
-    if (st->undo_stack_head == st->undo_count) return;
+    UndoStack *st = &ed->buf->undo_stack;
+    UndoElem elem;
+    U8 *text;
+    if (!undo_step_forward(st, &elem, &text, false)) return;
 
-    UndoElem elem = st->undo_stack[st->undo_stack_head++];
-    U8 *text = st->text_stack + st->text_stack_head;
-    st->text_stack_head += elem.text_length;
+    do {
+        switch (elem.op) {
+            case UndoOp_Insert:
+                editor_text_insert_raw(ed, elem.at, text, (I64)elem.text_length);
+                break;
+            case UndoOp_Remove:
+                editor_text_remove_raw(ed, elem.at, elem.at + (I64)elem.text_length);
+                break;
+        }
+    } while (undo_step_forward(st, &elem, &text, true));
+    
+    ed->buf->flags |= EditorFlag_Unsaved;
+}
 
-    switch (elem.op) {
-        case UndoOp_Insert:
-            editor_text_insert_raw(ed, elem.at, text, (I64)elem.text_length);
-            break;
-        case UndoOp_Remove:
-            editor_text_remove_raw(ed, elem.at, elem.at + (I64)elem.text_length);
-            break;
+// Inside a group, an edit next to the last element is merged into it: typing
+// extends an insertion, deleting either way extends a removal, and deleting
+// the end of an insertion shortens it.
+static U8 *undo_coalesce(UndoStack *st, I64 at, I64 text_length, UndoOp op) {
+    if (st->group_depth == 0 || st->undo_stack_head <= st->group_start)
+        return NULL;
+    // saved elements are in the history file as they are
+    if (st->undo_stack_head <= st->disk_saved)
+        return NULL;
+
+    UndoElem *top = &st->undo_stack[st->undo_stack_head-1];
+    I64 top_end = top->at + (I64)top->text_length;
+    if ((U64)top->text_length + (U64)text_length > UINT32_MAX)
+        return NULL;
+
+    // only hot text can grow or shrink
+    U64 top_offset = st->text_stack_head - top->text_length;
+    if (top_offset < st->hot_start || st->hot_length + (U64)text_length > UNDO_TEXT_SIZE)
+        return NULL;
+
+    if (top->op == op && op == UndoOp_Insert && at == top_end) {
+        U8 *text = st->text_stack + st->hot_length;
+        top->text_length += (U32)text_length;
+        st->text_stack_head += (U64)text_length;
+        st->hot_length += (U64)text_length;
+        return text;
     }
-    
-    ed->flags |= EditorFlag_Unsaved;
+
+    if (top->op == op && op == UndoOp_Remove && at == top->at) {
+        U8 *text = st->text_stack + st->hot_length;
+        top->text_length += (U32)text_length;
+        st->text_stack_head += (U64)text_length;
+        st->hot_length += (U64)text_length;
+        return text;
+    }
+
+    if (top->op == op && op == UndoOp_Remove && at + text_length == top->at) {
+        U8 *text = st->text_stack + st->hot_length - top->text_length;
+        memmove(text + text_length, text, top->text_length);
+        top->at = at;
+        top->text_length += (U32)text_length;
+        st->text_stack_head += (U64)text_length;
+        st->hot_length += (U64)text_length;
+        return text;
+    }
+
+    // the removed text was never there before the group, nothing to record.
+    // The caller still copies it out, into the space past the stack head.
+    if (top->op == UndoOp_Insert && op == UndoOp_Remove && at >= top->at && at + text_length == top_end) {
+        top->text_length -= (U32)text_length;
+        st->text_stack_head -= (U64)text_length;
+        st->hot_length -= (U64)text_length;
+        if (top->text_length == 0)
+            st->undo_stack_head--;
+        st->undo_count = st->undo_stack_head;
+        return st->text_stack + st->hot_length;
+    }
+
+    return NULL;
+}
+
+static U64 undo_memory(UndoStack *st) {
+    return st->packed_length + st->hot_length + (U64)st->undo_count * sizeof(UndoElem);
+}
+
+static U64 undo_record_length(UndoElem *elem) {
+    return sizeof(UndoElem) + elem->text_length + sizeof(U64);
+}
+
+// Forgets the elements past the stack head, before recording a new one.
+static void undo_truncate(UndoStack *st) {
+    if (st->disk_head < st->disk_base) {
+        // the head is in the history file
+        st->disk_base = st->disk_head;
+        st->disk_base_offset = st->disk_head_offset;
+        st->disk_saved = 0;
+        st->disk_end = st->disk_base_offset;
+    }
+    while (st->disk_saved > st->undo_stack_head)
+        st->disk_end -= undo_record_length(&st->undo_stack[--st->disk_saved]);
+
+    st->undo_count = st->undo_stack_head;
+    if (st->undo_count == 0) {
+        st->text_base = st->text_stack_head;
+        st->hot_start = st->text_stack_head;
+        st->hot_length = 0;
+        st->hot_first = 0;
+        st->block_count = 0;
+        st->packed_length = 0;
+        st->thawed_start = UINT64_MAX;
+        return;
+    }
+    if (st->text_stack_head >= st->hot_start) {
+        st->hot_length = st->text_stack_head - st->hot_start;
+        return;
+    }
+
+    // the head is in a block, the rest of it goes unused
+    st->hot_start = st->text_stack_head;
+    st->hot_length = 0;
+    st->hot_first = st->undo_stack_head;
+    while (st->block_count && st->blocks[st->block_count-1].stream_start >= st->text_stack_head) {
+        st->block_count--;
+        st->packed_length = st->blocks[st->block_count].packed_start;
+    }
+    st->thawed_start = UINT64_MAX;
+}
+
+// Packs the oldest hot text, a block's worth of whole elements, into a block.
+static bool undo_freeze(UndoStack *st) {
+    if (st->hot_first == st->undo_count || st->block_count == UNDO_MAX_BLOCK_COUNT)
+        return false;
+
+    U32 elem_count = 0;
+    U64 raw_length = 0;
+    while (st->hot_first + elem_count < st->undo_count && raw_length < UNDO_BLOCK_SIZE)
+        raw_length += st->undo_stack[st->hot_first + elem_count++].text_length;
+    if (st->packed_length + lz_bound(raw_length) > UNDO_PACKED_SIZE)
+        return false;
+
+    U64 packed_length = lz_compress(st->text_stack, raw_length, st->packed + st->packed_length);
+    st->blocks[st->block_count++] = (UndoBlock) {
+        .stream_start = st->hot_start,
+        .raw_length = raw_length,
+        .packed_start = st->packed_length,
+        .packed_length = packed_length,
+    };
+    st->packed_length += packed_length;
+
+    memmove(st->text_stack, st->text_stack + raw_length, st->hot_length - raw_length);
+    st->hot_start += raw_length;
+    st->hot_length -= raw_length;
+    st->hot_first += elem_count;
+    return true;
 }
 
-UndoElem *undo_record(UndoStack *st, I64 at, U8 *text, I64 text_length, UndoOp op) { TRACE
-    if (text_length == 0) return NULL;
+// Forgets the oldest elements: those with text in the oldest block, or a
+// block's worth of hot text, on to the start of the next group.
+static bool undo_drop_oldest(UndoStack *st) {
+    if (st->undo_count == 0) return false;
+
+    U64 text_end = st->block_count != 0
+        ? st->blocks[0].stream_start + st->blocks[0].raw_length
+        : st->text_base + UNDO_BLOCK_SIZE;
+    U32 n = 0;
+    U64 offset = st->text_base;
+    U64 record_offset = st->disk_base_offset;
+    do {
+        record_offset += undo_record_length(&st->undo_stack[n]);
+        offset += st->undo_stack[n++].text_length;
+    } while (n < st->undo_count && (offset < text_end || st->undo_stack[n].joined));
+    expect(n <= st->undo_stack_head);
+
+    if (n <= st->disk_saved) {
+        // still in the history file, below the elements now
+        st->disk_base += n;
+        st->disk_head = st->disk_base;
+        st->disk_base_offset = record_offset;
+        st->disk_head_offset = record_offset;
+        st->disk_saved -= n;
+    } else {
+        // the file has a gap where unsaved elements were, start it over
+        undo_history_close(st);
+    }
+
+    memmove(st->undo_stack, st->undo_stack + n, (st->undo_count - n) * sizeof(UndoElem));
+    st->undo_count -= n;
+    st->undo_stack_head -= n;
+    st->hot_first = st->hot_first > n ? st->hot_first - n : 0;
+    st->group_start = st->group_start > n ? st->group_start - n : 0;
+    st->text_base = offset;
+    if (st->undo_count != 0)
+        st->undo_stack[0].joined = false;
+
+    if (offset > st->hot_start) {
+        U64 dropped = offset - st->hot_start;
+        memmove(st->text_stack, st->text_stack + dropped, st->hot_length - dropped);
+        st->hot_start = offset;
+        st->hot_length -= dropped;
+    }
+
+    U32 b = 0;
+    while (b < st->block_count && st->blocks[b].stream_start + st->blocks[b].raw_length <= offset)
+        b++;
+    if (b != 0) {
+        U64 packed_dropped = b < st->block_count ? st->blocks[b].packed_start : st->packed_length;
+        memmove(st->packed, st->packed + packed_dropped, st->packed_length - packed_dropped);
+        st->packed_length -= packed_dropped;
+        memmove(st->blocks, st->blocks + b, (st->block_count - b) * sizeof(UndoBlock));
+        st->block_count -= b;
+        for (U32 i = 0; i < st->block_count; ++i)
+            st->blocks[i].packed_start -= packed_dropped;
+        st->thawed_start = UINT64_MAX;
+    }
+    return true;
+}
 
-    expect(text_length <= UINT32_MAX);
-    expect(st->undo_stack_head < UNDO_MAX && st->text_stack_head + text_length < (I64)UNDO_TEXT_SIZE);
+// Returns the space for the caller to copy the recorded text into, or NULL
+// if the edit is too big to keep in the budget. That clears the history,
+// as what is left couldn't be undone past it.
+U8 *undo_record(UndoStack *st, I64 at, I64 text_length, UndoOp op) { TRACE
+    expect(0 < text_length && text_length <= UINT32_MAX);
+    U64 length = (U64)text_length;
 
+    undo_truncate(st);
+    U8 *coalesced = undo_coalesce(st, at, text_length, op);
+    if (coalesced) return coalesced;
+
+    while (st->hot_length + length > UNDO_HOT_SIZE && undo_freeze(st)) {}
+    while (undo_memory(st) + length + sizeof(UndoElem) > UNDO_MEMORY_BUDGET || st->undo_count == UNDO_MAX) {
+        if (!undo_drop_oldest(st)) break;
+    }
+    if (undo_memory(st) + length + sizeof(UndoElem) > UNDO_MEMORY_BUDGET || st->hot_length + length > UNDO_TEXT_SIZE) {
+        undo_clear(st);
+        return NULL;
+    }
+
+    bool joined = st->group_depth != 0 && st->undo_stack_head > st->group_start;
     UndoElem *new_elem = &st->undo_stack[st->undo_stack_head++];
-    *new_elem = (UndoElem) { at, (U32)text_length, op };
-    memcpy(st->text_stack + st->text_stack_head, text, (U32)text_length);
-    st->text_stack_head += (U32)text_length;
+    *new_elem = (UndoElem) { at, (U32)text_length, op, joined };
+    U8 *text = st->text_stack + st->hot_length;
+    st->text_stack_head += length;
+    st->hot_length += length;
     st->undo_count = st->undo_stack_head;
-    return new_elem;
+    return text;
 }
 
 UndoStack undo_create(Arena *arena) { TRACE
     U8 *text_stack = arena_alloc(arena, UNDO_TEXT_SIZE, page_size());
     UndoElem *undo_stack = arena_alloc(arena, UNDO_STACK_SIZE, page_size());
+    UndoBlock *blocks = arena_alloc(arena, UNDO_MAX_BLOCK_COUNT * sizeof(UndoBlock), alignof(UndoBlock));
+    U8 *packed = arena_alloc(arena, UNDO_PACKED_SIZE, page_size());
+    U8 *thawed = arena_alloc(arena, UNDO_TEXT_SIZE, page_size());
 
     return (UndoStack) {
         .text_stack = text_stack,
         .undo_stack = undo_stack,
+        .blocks = blocks,
+        .packed = packed,
+        .thawed = thawed,
+        .thawed_start = UINT64_MAX,
+        .disk_base_offset = sizeof(UndoHistoryHeader),
+        .disk_head_offset = sizeof(UndoHistoryHeader),
+        .disk_end = sizeof(UndoHistoryHeader),
     };
 }
 
 void undo_clear(UndoStack *st) { TRACE
     st->text_stack_head = 0;
+    st->text_base = 0;
     st->undo_stack_head = 0;
     st->undo_count = 0;
+    st->hot_start = 0;
+    st->hot_length = 0;
+    st->hot_first = 0;
+    st->block_count = 0;
+    st->packed_length = 0;
+    st->thawed_start = UINT64_MAX;
+    st->group_start = 0;
+    undo_history_close(st);
+}
+
+// Groups can nest, the outermost one decides what is undone together.
+void undo_group_begin(UndoStack *st) {
+    if (st->group_depth++ == 0)
+        st->group_start = st->undo_stack_head;
+}
+
+void undo_group_end(UndoStack *st) {
+    expect(st->group_depth != 0);
+    st->group_depth--;
+}
+
+static inline U64 undo_hash_mix(U64 h, U64 word) {
+    h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static void undo_hash_update(UndoHash *hs, const U8 *bytes, U64 length) {
+    while (hs->tail_length != 0 && length != 0) {
+        hs->tail |= (U64)*bytes++ << (8 * hs->tail_length++);
+        length--;
+        if (hs->tail_length == 8) {
+            hs->h = undo_hash_mix(hs->h, hs->tail);
+            hs->tail = 0;
+            hs->tail_length = 0;
+        }
+    }
+
+    U64 h = hs->h;
+    for (; length >= 8; length -= 8, bytes += 8) {
+        U64 word;
+        memcpy(&word, bytes, sizeof(word));
+        h = undo_hash_mix(h, word);
+    }
+    hs->h = h;
+
+    while (length != 0) {
+        hs->tail |= (U64)*bytes++ << (8 * hs->tail_length++);
+        length--;
+    }
+}
+
+static U64 undo_hash_final(UndoHash *hs) {
+    U64 h = undo_hash_mix(hs->h, hs->tail ^ ((U64)hs->tail_length << 56));
+    return undo_hash_mix(h, 0);
+}
+
+#define UNDO_HISTORY_MAGIC 0x3130796f646e7565ull // "eundoy01"
+
+// Reads the header of the history file, if it is one for contents this long.
+static bool undo_history_header(int fd, U64 content_length, UndoHistoryHeader *header) {
+    struct stat stat_buf;
+    U64 size = fstat(fd, &stat_buf) == 0 ? (U64)stat_buf.st_size : 0;
+    bool ok = size >= sizeof(*header) && pread(fd, header, sizeof(*header), 0) == (ssize_t)sizeof(*header);
+    return ok
+        && header->magic == UNDO_HISTORY_MAGIC
+        && header->content_length == content_length
+        && header->record_count <= UINT32_MAX
+        && sizeof(*header) <= header->end && header->end <= size;
+}
+
+// Whether there is history that may end at contents this long, so they are
+// worth hashing to find out.
+bool undo_history_exists(const char *path, U64 content_length) { TRACE
+    if (path[0] == 0) return false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    UndoHistoryHeader header;
+    bool ok = undo_history_header(fd, content_length, &header);
+    close(fd);
+    return ok;
+}
+
+// Picks up the history kept for the file, if it ends at contents that
+// hashed to `content_hash`.
+void undo_history_open(UndoStack *st, const char *path, U64 content_hash, U64 content_length) { TRACE
+    undo_history_close(st);
+    if (path[0] == 0) return;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    UndoHistoryHeader header;
+    bool ok = undo_history_header(fd, content_length, &header)
+        && header.content_hash == content_hash;
+
+    U8 *map = NULL;
+    if (ok) {
+        map = mmap(NULL, header.end, PROT_READ, MAP_SHARED, fd, 0);
+        ok = (void*)map != MAP_FAILED;
+    }
+    close(fd);
+    if (!ok) return;
+
+    st->disk_map = map;
+    st->disk_map_length = header.end;
+    st->disk_base = (U32)header.record_count;
+    st->disk_head = st->disk_base;
+    st->disk_base_offset = header.end;
+    st->disk_head_offset = header.end;
+    st->disk_end = header.end;
+}
+
+// Makes the file hold the history up to the head, for the contents just
+// saved, appending the elements not yet in it. Returns 0 on success.
+int undo_history_write(UndoStack *st, const char *path, U64 content_hash, U64 content_length) { TRACE
+    if (path[0] == 0) return -1;
+
+    // past the limit, start over from what is in memory
+    bool in_file = st->disk_head == st->disk_base;
+    if (in_file && st->disk_end > UNDO_HISTORY_MAX_SIZE)
+        undo_history_close(st);
+
+    // create the directories on the way
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        mkdir(dir, 0700);
+        *slash = '/';
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return -2;
+    FILE *f = fdopen(fd, "r+b");
+    if (f == NULL) {
+        close(fd);
+        return -2;
+    }
+
+    // on failure the file is left as it was, as far as the stack knows
+    U32 saved = st->disk_saved;
+    U64 saved_end = st->disk_end;
+
+    // elements undone in memory stay in the file past its end, to be redone
+    U64 record_count = st->disk_head;
+    U64 end = st->disk_head_offset;
+    bool ok = true;
+    if (in_file) {
+        U64 offset = st->text_stack_head;
+        for (U32 i = saved; i < st->undo_stack_head; ++i)
+            offset -= st->undo_stack[i].text_length;
+
+        ok = fseeko(f, (off_t)saved_end, SEEK_SET) == 0;
+        for (U32 i = saved; ok && i < st->undo_stack_head; ++i) {
+            UndoElem elem = st->undo_stack[i];
+            U64 record_length = undo_record_length(&elem);
+            ok = fwrite(&elem, sizeof(elem), 1, f) == 1
+                && fwrite(undo_text(st, offset), elem.text_length, 1, f) == 1
+                && fwrite(&record_length, sizeof(record_length), 1, f) == 1;
+            offset += elem.text_length;
+            st->disk_end += record_length;
+        }
+        if (st->disk_saved < st->undo_stack_head)
+            st->disk_saved = st->undo_stack_head;
+
+        record_count = st->disk_base + st->undo_stack_head;
+        end = st->disk_end;
+        for (U32 i = st->undo_stack_head; i < st->disk_saved; ++i)
+            end -= undo_record_length(&st->undo_stack[i]);
+    }
+
+    UndoHistoryHeader header = {
+        .magic = UNDO_HISTORY_MAGIC,
+        .content_hash = content_hash,
+        .content_length = content_length,
+        .record_count = record_count,
+        .end = end,
+    };
+    ok = ok
+        && fseeko(f, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, f) == 1
+        && fflush(f) == 0
+        && ftruncate(fd, (off_t)st->disk_end) == 0;
+
+    // map what was written, for undo past element 0 once it is dropped
+    U8 *map = NULL;
+    if (ok) {
+        map = mmap(NULL, st->disk_end, PROT_READ, MAP_SHARED, fd, 0);
+        ok = (void*)map != MAP_FAILED;
+    }
+    fclose(f);
+    if (!ok) {
+        st->disk_saved = saved;
+        st->disk_end = saved_end;
+        return -3;
+    }
+
+    if (st->disk_map) munmap(st->disk_map, st->disk_map_length);
+    st->disk_map = map;
+    st->disk_map_length = st->disk_end;
+    return 0;
+}
+
+// Forgets the history file, the elements in memory are all that is left.
+void undo_history_close(UndoStack *st) {
+    if (st->disk_map) munmap(st->disk_map, st->disk_map_length);
+    st->disk_map = NULL;
+    st->disk_map_length = 0;
+    st->disk_base = 0;
+    st->disk_head = 0;
+    st->disk_saved = 0;
+    st->disk_base_offset = sizeof(UndoHistoryHeader);
+    st->disk_head_offset = sizeof(UndoHistoryHeader);
+    st->disk_end = sizeof(UndoHistoryHeader);
 }
 
 // returns number of digits
@@ -1908,9 +4529,9 @@ Indices editor_find_lines(Editor *ed, Arena *arena, I64 start, I64 end) {
 
 // returns true if line comment prefix was found
 static bool editor_line_comment_prefix(Editor *ed, U8 *prefix) {
-    for (U64 i = 0; i < ed->syntax.group_count; ++i) {
-        if (ed->syntax.groups[i].end_chars[0] == '\n') {
-            memcpy(prefix, ed->syntax.groups[i].start_chars, EDITOR_SYNTAX_GROUP_SIZE);
+    for (U64 i = 0; i < ed->buf->syntax.group_count; ++i) {
+        if (ed->buf->syntax.groups[i].end_chars[0] == '\n') {
+            memcpy(prefix, ed->buf->syntax.groups[i].start_chars, EDITOR_SYNTAX_GROUP_SIZE);
             return true;
         }
     }
@@ -1946,9 +4567,11 @@ void editor_comment_lines(Editor *ed, Indices lines) {
         return;
     
     I64 indent = editor_min_indent(ed, lines);
+    Insertion *insertions = ARENA_ALLOC_ARRAY(frame_arena, Insertion, lines.count);
+    U64 insert_count = 0;
     
-    for (U64 i = lines.count; i != 0; --i) {
-        Range line = editor_group(ed, Group_Line, lines.ptr[i-1]);
+    for (U64 i = 0; i < lines.count; ++i) {
+        Range line = editor_group(ed, Group_Line, lines.ptr[i]);
         
         bool all_whitespace = true;
         for (I64 j = line.start; j != line.end; ++j) {
@@ -1973,10 +4596,11 @@ void editor_comment_lines(Editor *ed, Indices lines) {
         *(U8*)ARENA_ALLOC(frame_arena, U8) = ' ';
         
         if (!already_commented) {
-            I64 comment_length = (I64)(frame_arena->head - comment_text);
-            editor_text_insert(ed, line.start + indent, comment_text, comment_length);
+            U64 comment_length = (U64)(frame_arena->head - comment_text);
+            insertions[insert_count++] = (Insertion) { line.start + indent, comment_length, comment_text };
         }
     }
+    editor_text_insert_bulk(ed, insertions, insert_count);
 }
 
 void editor_uncomment_lines(Editor *ed, Indices lines) {
@@ -1984,8 +4608,10 @@ void editor_uncomment_lines(Editor *ed, Indices lines) {
     if (!editor_line_comment_prefix(ed, prefix))
         return;
         
-    for (U64 i = lines.count; i != 0; --i) {
-        Range line = editor_group(ed, Group_Line, lines.ptr[i-1]);
+    Range *ranges = ARENA_ALLOC_ARRAY(&w->frame_arena, Range, lines.count);
+    U64 range_count = 0;
+    for (U64 i = 0; i < lines.count; ++i) {
+        Range line = editor_group(ed, Group_Line, lines.ptr[i]);
         
         while (line.start != line.end) {
             I64 j = 0;
@@ -1999,13 +4625,14 @@ void editor_uncomment_lines(Editor *ed, Indices lines) {
             if (editor_text(ed, line.start + j) == ' ')
                 j++;
             
-            editor_text_remove(ed, line.start, line.start + j);
+            ranges[range_count++] = (Range) { line.start, line.start + j };
             break;
                 
             NEXT_CHAR:
             line.start++;
         }
     }
+    editor_text_remove_bulk(ed, ranges, range_count);
 }
 
 void editor_set_selection(Editor *ed, I64 base, I64 head) {
@@ -2022,6 +4649,7 @@ void editor_set_selection(Editor *ed, I64 base, I64 head) {
 }
 
 void editor_goto_line(Editor *ed, I64 line_idx) {
+    editor_load_wait(ed, line_idx);
     I64 byte = editor_byte_index(ed, line_idx);
     Range line = editor_group(ed, Group_Line, byte);
     editor_set_selection(ed, line.start, line.end);
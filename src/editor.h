@@ -3,6 +3,11 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/syscall.h>
 
 typedef struct Range {
     I64 start;
@@ -45,16 +50,76 @@ typedef struct UndoElem {
     I64 at;
     U32 text_length;
     U8 op;
+    bool joined; // undone and redone together with the element before it
 } UndoElem;
 
+// The text of every element, in order, makes up one stream.
+// Recent text is kept as is, older text is packed into blocks.
+typedef struct UndoBlock {
+    U64 stream_start;
+    U64 raw_length;
+    U64 packed_start;
+    U64 packed_length;
+} UndoBlock;
+
 typedef struct UndoStack {
-    U8 *text_stack;
     UndoElem *undo_stack;
-    U32 text_stack_head;
     U32 undo_stack_head;
     U32 undo_count;
+
+    // stream offsets of the text of element undo_stack_head and element 0
+    U64 text_stack_head;
+    U64 text_base;
+
+    // the stream from hot_start, the text of elements from hot_first on
+    U8 *text_stack;
+    U64 hot_start;
+    U64 hot_length;
+    U32 hot_first;
+
+    UndoBlock *blocks;
+    U32 block_count;
+    U8 *packed;
+    U64 packed_length;
+
+    // the block last unpacked for undo or redo
+    U8 *thawed;
+    U64 thawed_start;
+
+    // History from earlier sessions, in the mapped history file. Its records
+    // [0, disk_base) come before element 0 and disk_head of them are applied.
+    // The first disk_saved elements are its records from disk_base on.
+    U8 *disk_map;
+    U64 disk_map_length;
+    U32 disk_base;
+    U32 disk_head;
+    U32 disk_saved;
+    U64 disk_base_offset; // file offsets of record disk_base,
+    U64 disk_head_offset; // of record disk_head,
+    U64 disk_end;         // and past the saved elements
+
+    // elements recorded between undo_group_begin and undo_group_end are joined
+    U32 group_depth;
+    U32 group_start;
 } UndoStack;
 
+// The history file is this header, then the records: an element, its text,
+// and the length of the record so the file can be read backwards.
+typedef struct UndoHistoryHeader {
+    U64 magic;
+    U64 content_hash;   // of the file the history ends at
+    U64 content_length;
+    U64 record_count;
+    U64 end;
+} UndoHistoryHeader;
+
+// Hashes bytes a word at a time, the same however they are split up.
+typedef struct UndoHash {
+    U64 h;
+    U64 tail;
+    U32 tail_length;
+} UndoHash;
+
 enum EditorFlags {
     EditorFlag_Unsaved = (1ul << 0ul),
 };
@@ -72,11 +137,113 @@ typedef struct SyntaxHighlighting {
     U64 char_is_syntax_start[4];
 } SyntaxHighlighting;
 
+// `end` is the last byte of the range.
+// `group` indexes into SyntaxHighlighting.groups.
 typedef struct SyntaxRange {
-    U32 start, end;
-    RGBA8 colour;
+    U64 start, end;
+    U32 group;
 } SyntaxRange;
 
+// Indexes a newly opened file on a worker thread. The worker counts the
+// newlines of each piece slice and lexes syntax ranges straight from the
+// file mapping, publishing its progress a line boundary at a time.
+// The editor appends what has been published to the text every frame.
+// Counting is split into chunks that counter threads claim in order,
+// so it runs ahead of the lexer on every core.
+// A stream of unknown length is read into the original buffer by the worker
+// instead, which publishes each read up to its last newline.
+typedef struct EditorLoader {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t published;
+    pthread_cond_t counted;
+    bool running;
+
+    // worker only
+    pthread_t counters[LOAD_MAX_THREADS];
+    U32 counter_count;
+    UndoHash hash;      // of the file, read by the editor once joined
+
+    // shared, under mutex
+    bool cancel;
+    bool done;
+    U64 indexed;
+    U32 range_count;
+    bool range_open;
+    U64 next_chunk;
+    U8 *chunk_counted;
+    bool non_ascii;    // read by the editor once joined
+    bool utf8_invalid;
+
+    // written by the worker, read by the editor below `indexed`
+    SyntaxHighlighting syntax;
+    U8 *original;
+    U64 original_length;
+    int stream_fd; // -1 unless streaming
+    U16 *slice_newlines; // a slice has at most TEXT_PIECE_MAX_LENGTH newlines
+    SyntaxRange *ranges;
+
+    // editor only
+    U32 absorbed_ranges;
+    bool absorbed_open;
+    bool hash_content;    // set before starting, if a history may be the file's
+    bool history_pending; // it is picked up once loaded, unless saved over
+} EditorLoader;
+
+// Watches the open file and appends whatever is written to its end.
+typedef struct EditorFollow {
+    int inotify_fd; // -1 when not following
+    int fd;
+    U64 size;       // bytes of the file in the text
+    bool terminated; // the last of those bytes is a newline
+    bool pending;   // more may be left to read
+} EditorFollow;
+
+// Saves a snapshot of the text on a worker thread, so editing goes on
+// meanwhile. The file is written next to the original, synced and renamed
+// over it, so it is never left half written.
+// The spans of the last save are kept, and the bytes at the start of the
+// text still pointing where they did then are kept from the old file, either
+// copied over in the kernel or left in place, so only the rest is written.
+typedef struct EditorSaver {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    bool running;
+    bool again;           // save once more when this one is done
+
+    // set before the worker starts
+    TextChunk *spans;
+    U64 span_count;
+    U64 length;
+    U64 unchanged;        // bytes at the start the file already holds
+    char path[PATH_MAX];
+
+    // the file as last read or saved, if nothing else wrote it since
+    TextChunk *disk_spans;
+    U64 disk_span_count;
+    U64 disk_inode;
+    U64 disk_size;
+    U64 disk_mtime_ns;
+    U64 mapped_inode;     // the file the original buffer maps is never written
+
+    // the hash of the file's first i * SAVE_HASH_STRIDE bytes, for the
+    // bytes that are copied over
+    UndoHash *hash_marks;
+    U64 hash_mark_count;
+    U64 hash_marks_kept;  // the ones still right if the save fails
+
+    // shared, under mutex
+    U64 written;
+    bool done;
+
+    // written by the worker, read once it is done
+    int err;
+    U64 hash;             // of the bytes written, for the undo history
+
+    // editor only
+    const char *error;    // why the last save failed, NULL if it didn't
+} EditorSaver;
+
 typedef struct PrevSearch {
     char *search;
     I64 search_length;
@@ -84,23 +251,75 @@ typedef struct PrevSearch {
     I64 replace_length;
 } PrevSearch;
 
-typedef struct Editor {
-    Arena *arena;
+// A file's text and everything derived from it, apart from any view of it.
+// Every view of a file shares its one buffer, and an edit in one view moves
+// the selections of the others. Buffers no view holds are kept in a cache of
+// recently used ones, each in an arena of its own, so switching back to a file
+// picks up where it was.
+typedef struct Buffer {
+    Arena arena;
+    U32 refs;              // views holding it
+    struct Editor *views;
+    bool listed;           // where views of its file find it
     UndoStack undo_stack;
     U8 *filepath;
     U32 filepath_length;
+    char real_path[PATH_MAX];    // the cache key, empty if not cached
+    char history_path[PATH_MAX]; // empty if there is nowhere to keep it
     SyntaxHighlighting syntax;
-    F64 scroll_y;
     U32 flags;
 
-    U8 *text;
-    I64 text_length;
-    
-    U32 *line_lookup;
+    // the file as it was read or last saved
+    U64 file_mtime_ns;
+    U64 file_size;
+    U64 file_inode;
+
+    Text text;
+    bool ascii;           // every byte is below 128, so each is a codepoint
+    bool utf8_invalid;    // what was read isn't all UTF-8
+    EditorLoader loader;
+    EditorFollow follow;
+    EditorSaver saver;
+
+    // the file's directory is watched for others writing it
+    int watch;            // -1 when not watched
+    bool disk_changed;    // to be looked at when nothing is in the way
+    bool disk_conflict;   // written while there were unsaved edits
+
+    // the view whose insert session's undo group is open, if any
+    struct Editor *insert_view;
+
+    // A gap buffer, read it with editor_syntax_range.
+    // Ranges before the gap store byte offsets, ranges after it sit at the end of
+    // syntax_lookup and store their distance from the end of the text.
+    // An edit at the gap leaves both sides valid, so nothing is shifted.
     SyntaxRange *syntax_lookup;
-    U32 line_count;
     U32 syntax_range_count;
+    U32 syntax_gap;
+
+    // the view it was last left with
+    I64 view_selection_base;
+    I64 view_selection_head;
+    Group view_selection_group;
+    F64 view_scroll_y;
 
+    // every buffer of a file, least recently used last
+    struct Buffer *lru_prev;
+    struct Buffer *lru_next;
+} Buffer;
+
+typedef struct BufferCache {
+    Buffer *first;
+    Buffer *last;
+    U32 cached_count; // those no view holds
+} BufferCache;
+
+typedef struct Editor {
+    Arena *arena;
+    Buffer *buf;
+    struct Editor *view_next; // the other views of the buffer
+    F64 scroll_y;
+    
     // may be out of order
     I64 selection_base;
     I64 selection_head;
@@ -120,9 +339,25 @@ typedef struct Editor {
     I64 search_a;
     I64 search_b;
     I64 *search_matches;
+    I64 *search_match_ends; // regex matches only, literal ones are mode_text_length long
     I64 search_match_count;
     I64 search_cursor;
 
+    // mode_text is a regular expression, toggled with ctrl+E
+    bool search_regex_mode;
+    bool search_regex_valid;
+    Regex search_regex;
+
+    // The matches are for this query, range and text version.
+    // They are found a step at a time, up to search_scanned.
+    U8 *search_query;
+    I64 search_query_length;
+    bool search_query_regex;
+    I64 search_query_a;
+    I64 search_query_b;
+    U64 search_version;
+    I64 search_scanned;
+
     char *prev_search_buffer;
     I64 prev_search_buffer_length;
     PrevSearch *prev_searches;
@@ -139,12 +374,18 @@ editor_create(UI *ui, const U8 *filepath);
 void
 editor_update(Panel *panel);
 
+void
+editor_destroy(Panel *panel);
+
 int
 editor_load_filepath(Editor *ed, const U8 *filepath, U32 filepath_length);
 
 void
 editor_goto_line(Editor *ed, I64 line_idx);
 
+void
+editor_save_wait_all(void);
+
 static inline I64 clamp(I64 n, I64 low, I64 high) {
     if (n < low) return low;
     if (n > high) return high;
@@ -165,8 +406,10 @@ static const U8 char_lookup[128] = {
 #include "ascii.c"
 };
 
+// Bytes of multi-byte UTF-8 are taken as letters, which keeps non-English
+// words together and never splits a codepoint.
 static inline bool char_word_like(U8 c) {
-    if (c >= 128) return false;
+    if (c >= 128) return true;
     CharType type = char_lookup[c];
     return type == Char_Alphabetic 
         || type == Char_Numeric
@@ -174,7 +417,7 @@ static inline bool char_word_like(U8 c) {
 }
 
 static inline bool char_subword_like(U8 c) {
-    if (c >= 128) return false;
+    if (c >= 128) return true;
     CharType type = char_lookup[c];
     return type == Char_Alphabetic || type == Char_Numeric;
 }
@@ -258,12 +258,13 @@ void filetree_update(Panel *panel) { TRACE
 
         if (!ctrl) {
             for (I64 i = 0; i < w->inputs.char_event_count; ++i) {
-                U32 codepoint = w->inputs.char_events[i].codepoint;
-                // enforce ascii for now
-                expect(codepoint < 128);
+                U8 bytes[4];
+                U32 length = utf8_encode(w->inputs.char_events[i].codepoint, bytes);
+                if (ft->search_buffer_head + length >= FILETREE_MAX_SEARCH_SIZE)
+                    break;
 
-                U8 codepoint_as_char = (U8)codepoint;
-                ft->search_buffer[ft->search_buffer_head++] = codepoint_as_char;
+                memcpy(&ft->search_buffer[ft->search_buffer_head], bytes, length);
+                ft->search_buffer_head += length;
                 ft->search_buffer[ft->search_buffer_head] = 0; // ensure null terminated
                 search_buffer_changed = true;
             }
@@ -271,7 +272,7 @@ void filetree_update(Panel *panel) { TRACE
             if (is(special_pressed | special_repeating, special_mask(GLFW_KEY_BACKSPACE))) {
                 if (ft->search_buffer_head > 0) {
                     search_buffer_changed = true;
-                    ft->search_buffer_head--;
+                    ft->search_buffer_head = (U32)utf8_char_before(ft->search_buffer, ft->search_buffer_head);
                 }
             }
         }
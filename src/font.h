@@ -51,6 +51,12 @@ glyph_lookup_idx(FontSize font_size, U8 ch) {
     return (U32)font_size * 256u + (U32)ch;
 }
 
+// the atlas holds Latin-1 up to U+00FE, other codepoints show as '?'
+static inline U32
+glyph_lookup_codepoint_idx(FontSize font_size, U32 codepoint) {
+    return glyph_lookup_idx(font_size, codepoint < 255 ? (U8)codepoint : (U8)'?');
+}
+
 FontAtlas *
 font_atlas_create(Arena *arena, const char *ttf);
 
@@ -0,0 +1,123 @@
+// LZ ########################################################################
+//
+// A token holds the literal count in its high nibble and the match length
+// past LZ_MIN_MATCH in its low one, 15 meaning more length bytes follow.
+// The last sequence is literals only.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 0xFFFF
+
+static U8 *lz_put_length(U8 *out, U64 n) {
+    while (n >= 255) {
+        *out++ = 255;
+        n -= 255;
+    }
+    *out++ = (U8)n;
+    return out;
+}
+
+static U8 *lz_put_literals(U8 *out, U8 *token, const U8 *literals, U64 count) {
+    *token = (U8)((count < 15 ? count : 15) << 4);
+    if (count >= 15)
+        out = lz_put_length(out, count - 15);
+    memcpy(out, literals, count);
+    return out + count;
+}
+
+// Returns the packed length, dst must hold lz_bound(length) bytes.
+U64 lz_compress(const U8 *src, U64 length, U8 *dst) {
+    expect(length <= UINT32_MAX);
+    U32 table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    U8 *out = dst;
+    U64 anchor = 0;
+    U64 i = 0;
+    while (i + LZ_MIN_MATCH <= length) {
+        U32 seq;
+        memcpy(&seq, src + i, sizeof(seq));
+        U32 hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        U64 candidate = table[hash];
+        table[hash] = (U32)i;
+
+        bool found = candidate < i
+            && i - candidate <= LZ_MAX_OFFSET
+            && memcmp(src + candidate, src + i, LZ_MIN_MATCH) == 0;
+        if (!found) {
+            // step faster through text that doesn't compress
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        U64 match = LZ_MIN_MATCH;
+        while (i + match < length && src[candidate + match] == src[i + match])
+            match++;
+
+        U8 *token = out++;
+        out = lz_put_literals(out, token, src + anchor, i - anchor);
+        U64 offset = i - candidate;
+        *out++ = (U8)offset;
+        *out++ = (U8)(offset >> 8);
+        U64 extra = match - LZ_MIN_MATCH;
+        *token |= (U8)(extra < 15 ? extra : 15);
+        if (extra >= 15)
+            out = lz_put_length(out, extra - 15);
+
+        i += match;
+        anchor = i;
+    }
+
+    U8 *token = out++;
+    out = lz_put_literals(out, token, src + anchor, length - anchor);
+    return (U64)(out - dst);
+}
+
+static bool lz_get_length(const U8 **src, const U8 *end, U64 *n) {
+    U8 b;
+    do {
+        if (*src == end) return false;
+        b = *(*src)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+// Returns false if the packed bytes don't unpack to exactly `length` bytes.
+bool lz_decompress(const U8 *src, U64 packed_length, U8 *dst, U64 length) {
+    const U8 *end = src + packed_length;
+    U64 o = 0;
+    while (src < end) {
+        U8 token = *src++;
+
+        U64 literals = token >> 4;
+        if (literals == 15 && !lz_get_length(&src, end, &literals))
+            return false;
+        if (literals > (U64)(end - src) || literals > length - o)
+            return false;
+        memcpy(dst + o, src, literals);
+        src += literals;
+        o += literals;
+        if (src == end) break;
+
+        if (end - src < 2) return false;
+        U64 offset = (U64)src[0] | (U64)src[1] << 8;
+        src += 2;
+        U64 match = token & 15;
+        if (match == 15 && !lz_get_length(&src, end, &match))
+            return false;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match > length - o)
+            return false;
+
+        // the match may overlap what it writes
+        if (offset >= match) {
+            memcpy(dst + o, dst + o - offset, match);
+        } else {
+            for (U64 k = 0; k < match; ++k)
+                dst[o + k] = dst[o + k - offset];
+        }
+        o += match;
+    }
+    return o == length;
+}
@@ -0,0 +1,15 @@
+#ifndef LZ_H_
+#define LZ_H_
+
+// A byte oriented LZ77 in the style of LZ4, for packing undo history.
+// Sequences are a token, literals, a 16 bit offset and the match length.
+
+// worst case packed size
+static inline U64 lz_bound(U64 length) {
+    return length + length / 255 + 16;
+}
+
+U64  lz_compress(const U8 *src, U64 length, U8 *dst);
+bool lz_decompress(const U8 *src, U64 packed_length, U8 *dst, U64 length);
+
+#endif
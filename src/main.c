@@ -3,12 +3,24 @@
 #include "font.c"
 
 #include "ui.h"
+#include "scan.h"
+#include "utf8.h"
+#include "lz.h"
+#include "diff.h"
+#include "regex.h"
+#include "text.h"
 #include "filetree.h"
 #include "editor.h"
 #include "jumplist.h"
 #include "mass.h"
 
 #include "ui.c"
+#include "scan.c"
+#include "utf8.c"
+#include "lz.c"
+#include "diff.c"
+#include "regex.c"
+#include "text.c"
 #include "filetree.c"
 #include "editor.c"
 #include "jumplist.c"
@@ -1390,6 +1402,7 @@ int main(int argc, char *argv[]) { INIT_TRACE
     }
 
     ui_destroy(ui);
+    editor_save_wait_all();
 
     VK_ASSERT(vkWaitForFences(w->device, 1, &w->in_flight, VK_TRUE, UINT64_MAX));
     vkDeviceWaitIdle(w->device);
@@ -1635,16 +1648,13 @@ bool write_inputs(U8 *text, U32 *text_len, U32 *cursor) {
         *cursor = *text_len;
     
     for (I64 i = 0; i < w->inputs.char_event_count; ++i) {
-        U32 codepoint = w->inputs.char_events[i].codepoint;
-        // enforce ascii for now
-        expect(codepoint < 128);
-
-        U8 codepoint_as_char = (U8)codepoint;
+        U8 bytes[4];
+        U32 length = utf8_encode(w->inputs.char_events[i].codepoint, bytes);
         
-        memmove(text + *cursor + 1, *text + cursor, *text_len - *cursor);
-        text[*cursor] = codepoint_as_char;
-        *text_len += 1;
-        *cursor += 1;
+        memmove(text + *cursor + length, text + *cursor, *text_len - *cursor);
+        memcpy(text + *cursor, bytes, length);
+        *text_len += length;
+        *cursor += length;
         
         ret = true;
     }
@@ -1653,9 +1663,10 @@ bool write_inputs(U8 *text, U32 *text_len, U32 *cursor) {
     U64 special_repeating = w->inputs.key_special_repeating;
     bool backspace = is(special_pressed | special_repeating, special_mask(GLFW_KEY_BACKSPACE));  
     if (*cursor > 0 && backspace) {
-        memmove(text + *cursor - 1, *text + cursor, *text_len - *cursor);
-        *text_len -= 1;
-        *cursor -= 1;
+        U32 start = (U32)utf8_char_before(text, *cursor);
+        memmove(text + start, text + *cursor, *text_len - *cursor);
+        *text_len -= *cursor - start;
+        *cursor = start;
         
         ret = true;
     }
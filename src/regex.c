@@ -0,0 +1,519 @@
+// REGEX #####################################################################
+
+// A piece of NFA being built: `end` is an empty state whose out is left
+// unset, to be pointed at whatever follows.
+typedef struct RegexFrag {
+    U32 start;
+    U32 end;
+} RegexFrag;
+
+typedef struct RegexParser {
+    Regex *re;
+    const U8 *pattern;
+    U64 length;
+    U64 i;
+    bool error;
+} RegexParser;
+
+static RegexFrag regex_parse_alt(RegexParser *p);
+
+static void regex_set_add(U64 *set, U8 lo, U8 hi) {
+    for (U32 b = lo; b <= hi; ++b)
+        set[b >> 6] |= 1ull << (b & 63);
+}
+
+static bool regex_set_has(const U64 *set, U8 b) {
+    return (set[b >> 6] >> (b & 63)) & 1;
+}
+
+// negated sets leave out newlines, matches only cross lines when asked to
+static void regex_set_negate(U64 *set) {
+    for (U32 i = 0; i < 4; ++i)
+        set[i] = ~set[i];
+    set[0] &= ~(1ull << '\n');
+}
+
+static U32 regex_state(Regex *re, U32 op) {
+    expect(re->nfa_count < REGEX_MAX_NFA_STATES);
+    U32 s = re->nfa_count++;
+    re->nfa[s] = (RegexNfaState) { .op = op, .out = REGEX_UNKNOWN, .out1 = REGEX_UNKNOWN };
+    return s;
+}
+
+static RegexFrag regex_frag(Regex *re, U32 op) {
+    U32 start = regex_state(re, op);
+    U32 end = regex_state(re, RegexOp_Empty);
+    re->nfa[start].out = end;
+    return (RegexFrag) { start, end };
+}
+
+// Adds the escape after a backslash to `set`.
+// Returns false if it was a single byte, which classes can use in a range.
+static bool regex_parse_escape(RegexParser *p, U64 *set, U8 *byte) {
+    if (p->i == p->length) {
+        p->error = true;
+        return false;
+    }
+    U8 c = p->pattern[p->i++];
+    U64 escaped[4] = { 0 };
+    switch (c) {
+        case 'd': case 'D':
+            regex_set_add(escaped, '0', '9');
+            break;
+        case 'w': case 'W':
+            regex_set_add(escaped, '0', '9');
+            regex_set_add(escaped, 'a', 'z');
+            regex_set_add(escaped, 'A', 'Z');
+            regex_set_add(escaped, '_', '_');
+            break;
+        case 's': case 'S':
+            regex_set_add(escaped, ' ', ' ');
+            regex_set_add(escaped, '\t', '\r');
+            break;
+        case 'n': *byte = '\n'; return false;
+        case 't': *byte = '\t'; return false;
+        case 'r': *byte = '\r'; return false;
+        default:  *byte = c; return false;
+    }
+
+    if (c == 'D' || c == 'W' || c == 'S')
+        regex_set_negate(escaped);
+    for (U32 i = 0; i < 4; ++i)
+        set[i] |= escaped[i];
+    return true;
+}
+
+static void regex_parse_class(RegexParser *p, U64 *set) {
+    U64 class[4] = { 0 };
+    bool negate = p->i < p->length && p->pattern[p->i] == '^';
+    if (negate) p->i++;
+
+    bool first = true;
+    while (true) {
+        if (p->i == p->length) {
+            p->error = true;
+            return;
+        }
+
+        U8 c = p->pattern[p->i++];
+        if (c == ']' && !first) break;
+        first = false;
+
+        U8 lo = c;
+        if (c == '\\') {
+            if (regex_parse_escape(p, class, &lo)) continue;
+            if (p->error) return;
+        }
+
+        U8 hi = lo;
+        bool range = p->i + 1 < p->length
+            && p->pattern[p->i] == '-'
+            && p->pattern[p->i+1] != ']';
+        if (range) {
+            p->i++;
+            hi = p->pattern[p->i++];
+            if (hi == '\\') {
+                U64 unused[4] = { 0 };
+                if (regex_parse_escape(p, unused, &hi))
+                    p->error = true;
+            }
+            if (p->error || hi < lo) {
+                p->error = true;
+                return;
+            }
+        }
+        regex_set_add(class, lo, hi);
+    }
+
+    if (negate) regex_set_negate(class);
+    memcpy(set, class, sizeof(class));
+}
+
+static RegexFrag regex_parse_atom(RegexParser *p) {
+    Regex *re = p->re;
+    U8 c = p->pattern[p->i++];
+    switch (c) {
+        case '(': {
+            RegexFrag f = regex_parse_alt(p);
+            if (p->i == p->length || p->pattern[p->i] != ')')
+                p->error = true;
+            p->i++;
+            return f;
+        }
+        case '*': case '+': case '?':
+            p->error = true;
+            return regex_frag(re, RegexOp_Empty);
+        case '^':
+            return regex_frag(re, RegexOp_LineStart);
+        case '$':
+            return regex_frag(re, RegexOp_LineEnd);
+        default:
+            break;
+    }
+
+    RegexFrag f = regex_frag(re, RegexOp_Byte);
+    U64 *set = re->nfa[f.start].set;
+    if (c == '.') {
+        regex_set_negate(set);
+    } else if (c == '[') {
+        regex_parse_class(p, set);
+    } else if (c == '\\') {
+        U8 byte;
+        if (!regex_parse_escape(p, set, &byte))
+            regex_set_add(set, byte, byte);
+    } else {
+        regex_set_add(set, c, c);
+    }
+    return f;
+}
+
+static RegexFrag regex_parse_repeat(RegexParser *p) {
+    Regex *re = p->re;
+    RegexFrag f = regex_parse_atom(p);
+    while (!p->error && p->i < p->length) {
+        U8 c = p->pattern[p->i];
+        if (c != '*' && c != '+' && c != '?') break;
+        p->i++;
+
+        U32 split = regex_state(re, RegexOp_Split);
+        U32 end = regex_state(re, RegexOp_Empty);
+        re->nfa[split].out = f.start;
+        re->nfa[split].out1 = end;
+        if (c == '?') {
+            re->nfa[f.end].out = end;
+            f = (RegexFrag) { split, end };
+        } else {
+            re->nfa[f.end].out = split;
+            f = (RegexFrag) { c == '*' ? split : f.start, end };
+        }
+    }
+    return f;
+}
+
+static RegexFrag regex_parse_concat(RegexParser *p) {
+    U32 start = regex_state(p->re, RegexOp_Empty);
+    RegexFrag f = { start, start };
+    while (!p->error && p->i < p->length) {
+        U8 c = p->pattern[p->i];
+        if (c == '|' || c == ')') break;
+        RegexFrag next = regex_parse_repeat(p);
+        p->re->nfa[f.end].out = next.start;
+        f.end = next.end;
+    }
+    return f;
+}
+
+static RegexFrag regex_parse_alt(RegexParser *p) {
+    Regex *re = p->re;
+    RegexFrag f = regex_parse_concat(p);
+    while (!p->error && p->i < p->length && p->pattern[p->i] == '|') {
+        p->i++;
+        RegexFrag g = regex_parse_concat(p);
+        U32 split = regex_state(re, RegexOp_Split);
+        U32 end = regex_state(re, RegexOp_Empty);
+        re->nfa[split].out = f.start;
+        re->nfa[split].out1 = g.start;
+        re->nfa[f.end].out = end;
+        re->nfa[g.end].out = end;
+        f = (RegexFrag) { split, end };
+    }
+    return f;
+}
+
+// DFA -----------------------------------------------------------------------
+
+static void regex_dfa_flush(RegexDfa *dfa) {
+    memset(dfa->table, 0, REGEX_DFA_TABLE_SIZE * sizeof(U32));
+    dfa->start[0] = REGEX_UNKNOWN;
+    dfa->start[1] = REGEX_UNKNOWN;
+    dfa->set_length = 0;
+
+    // the dead state, the empty set, goes nowhere
+    RegexDfaState *dead = &dfa->states[REGEX_DEAD];
+    memset(dead->next, 0, sizeof(dead->next));
+    dead->set_start = 0;
+    dead->set_count = 0;
+    dead->hash = 0;
+    dead->flags = 0;
+    dfa->state_count = 1;
+}
+
+// Adds the states reachable from `s` without reading a byte to `list`, keeping
+// the ones that read a byte, match or wait for a line end. With `line_end`
+// the line is known to end here and the waiting ones go on.
+static void regex_closure(Regex *re, U32 s, bool line_start, bool line_end, U32 *list, U32 *count) {
+    if (re->marks[s] == re->mark) return;
+    re->marks[s] = re->mark;
+
+    U32 top = 0;
+    re->stack[top++] = s;
+    while (top) {
+        s = re->stack[--top];
+        RegexNfaState *st = &re->nfa[s];
+        U32 outs[2] = { REGEX_UNKNOWN, REGEX_UNKNOWN };
+        switch (st->op) {
+            case RegexOp_LineEnd:
+                if (line_end) {
+                    outs[0] = st->out;
+                    break;
+                }
+                list[(*count)++] = s;
+                break;
+            case RegexOp_Byte:
+            case RegexOp_Match:
+                list[(*count)++] = s;
+                break;
+            case RegexOp_LineStart:
+                if (line_start) outs[0] = st->out;
+                break;
+            case RegexOp_Empty:
+                outs[0] = st->out;
+                break;
+            case RegexOp_Split:
+                outs[0] = st->out1;
+                outs[1] = st->out;
+                break;
+        }
+        for (U32 i = 0; i < 2; ++i) {
+            U32 out = outs[i];
+            if (out == REGEX_UNKNOWN || re->marks[out] == re->mark) continue;
+            re->marks[out] = re->mark;
+            re->stack[top++] = out;
+        }
+    }
+}
+
+static int regex_u32_cmp(const void *a, const void *b) {
+    U32 x = *(const U32*)a;
+    U32 y = *(const U32*)b;
+    return (x > y) - (x < y);
+}
+
+static U32 regex_set_hash(const U32 *set, U32 count, U32 flags) {
+    U32 hash = 2166136261u ^ flags;
+    for (U32 i = 0; i < count; ++i)
+        hash = (hash ^ set[i]) * 16777619u;
+    return hash;
+}
+
+// Finds or makes the state for a set of NFA states, sorting it first.
+// Flushes the cache when it is full, which invalidates every other state.
+static U32 regex_dfa_state(Regex *re, RegexDfa *dfa, U32 *set, U32 count, bool line_start, bool *flushed) {
+    *flushed = false;
+    if (count == 0 && !dfa->unanchored) return REGEX_DEAD;
+
+    qsort(set, count, sizeof(U32), regex_u32_cmp);
+    U32 flags = line_start ? REGEX_FLAG_LINE_START : 0;
+    U32 hash = regex_set_hash(set, count, flags);
+
+    U32 mask = REGEX_DFA_TABLE_SIZE - 1;
+    U32 slot = hash & mask;
+    while (dfa->table[slot] != 0) {
+        RegexDfaState *st = &dfa->states[dfa->table[slot]];
+        bool same = st->hash == hash
+            && st->set_count == count
+            && (st->flags & REGEX_FLAG_LINE_START) == flags
+            && memcmp(&dfa->sets[st->set_start], set, count * sizeof(U32)) == 0;
+        if (same) return dfa->table[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    bool full = dfa->state_count == REGEX_MAX_DFA_STATES
+        || dfa->set_length + count > REGEX_MAX_DFA_SET_LENGTH;
+    if (full) {
+        regex_dfa_flush(dfa);
+        *flushed = true;
+        slot = hash & mask;
+    }
+
+    // a match here is unconditional, or waits for a line end to be seen
+    bool waits = false;
+    for (U32 i = 0; i < count; ++i) {
+        U32 op = re->nfa[set[i]].op;
+        if (op == RegexOp_Match) flags |= REGEX_FLAG_MATCH;
+        if (op == RegexOp_LineEnd) waits = true;
+    }
+    if (waits && !(flags & REGEX_FLAG_MATCH)) {
+        U32 *ends = re->list + 2*REGEX_MAX_NFA_STATES;
+        U32 end_count = 0;
+        re->mark++;
+        for (U32 i = 0; i < count; ++i) {
+            if (re->nfa[set[i]].op == RegexOp_LineEnd)
+                regex_closure(re, re->nfa[set[i]].out, line_start, true, ends, &end_count);
+        }
+        for (U32 i = 0; i < end_count; ++i) {
+            if (re->nfa[ends[i]].op == RegexOp_Match)
+                flags |= REGEX_FLAG_MATCH_AT_LINE_END;
+        }
+    }
+
+    if (dfa->unanchored && count == re->start_count[line_start])
+        flags |= REGEX_FLAG_IDLE;
+
+    U32 id = dfa->state_count++;
+    RegexDfaState *st = &dfa->states[id];
+    memset(st->next, 0xFF, sizeof(st->next));
+    st->set_start = dfa->set_length;
+    st->set_count = count;
+    st->hash = hash;
+    st->flags = flags;
+    memcpy(&dfa->sets[dfa->set_length], set, count * sizeof(U32));
+    dfa->set_length += count;
+
+    while (dfa->table[slot] != 0)
+        slot = (slot + 1) & mask;
+    dfa->table[slot] = id;
+    return id;
+}
+
+Regex regex_create(Arena *arena) { TRACE
+    Regex re = {
+        .nfa = ARENA_ALLOC_ARRAY(arena, RegexNfaState, REGEX_MAX_NFA_STATES),
+        .stack = ARENA_ALLOC_ARRAY(arena, U32, REGEX_MAX_NFA_STATES),
+        .list = ARENA_ALLOC_ARRAY(arena, U32, 3*REGEX_MAX_NFA_STATES),
+        .marks = ARENA_ALLOC_ARRAY(arena, U32, REGEX_MAX_NFA_STATES),
+        .prefix = ARENA_ALLOC_ARRAY(arena, U8, MODE_TEXT_MAX_LENGTH),
+    };
+
+    RegexDfa *dfas[2] = { &re.anchored, &re.unanchored };
+    for (U32 i = 0; i < 2; ++i) {
+        *dfas[i] = (RegexDfa) {
+            .states = ARENA_ALLOC_ARRAY(arena, RegexDfaState, REGEX_MAX_DFA_STATES),
+            .sets = ARENA_ALLOC_ARRAY(arena, U32, REGEX_MAX_DFA_SET_LENGTH),
+            .table = ARENA_ALLOC_ARRAY(arena, U32, REGEX_DFA_TABLE_SIZE),
+            .unanchored = i == 1,
+        };
+        regex_dfa_flush(dfas[i]);
+    }
+    return re;
+}
+
+// Returns false if the pattern is malformed or too long.
+bool regex_compile(Regex *re, const U8 *pattern, U64 length) { TRACE
+    if (length > MODE_TEXT_MAX_LENGTH) return false;
+    re->nfa_count = 0;
+    re->prefix_length = 0;
+    regex_dfa_flush(&re->anchored);
+    regex_dfa_flush(&re->unanchored);
+
+    RegexParser p = { .re = re, .pattern = pattern, .length = length };
+    RegexFrag f = regex_parse_alt(&p);
+    if (p.error || p.i != length) {
+        re->nfa_count = 0;
+        return false;
+    }
+
+    U32 match = regex_state(re, RegexOp_Match);
+    re->nfa[f.end].out = match;
+    re->nfa_start = f.start;
+
+    // the single bytes on the path every match takes before any branch
+    U32 s = re->nfa_start;
+    while (s != match) {
+        RegexNfaState *st = &re->nfa[s];
+        if (st->op == RegexOp_Byte) {
+            U32 count = 0;
+            U8 byte = 0;
+            for (U32 b = 0; b < 256; ++b) {
+                if (regex_set_has(st->set, (U8)b)) {
+                    count++;
+                    byte = (U8)b;
+                }
+            }
+            if (count != 1) break;
+            re->prefix[re->prefix_length++] = byte;
+        } else if (st->op != RegexOp_Empty && st->op != RegexOp_LineStart) {
+            break;
+        }
+        s = st->out;
+    }
+
+    re->first = (ScanSet) { 0 };
+    for (U32 line_start = 0; line_start < 2; ++line_start) {
+        U32 count = 0;
+        re->mark++;
+        regex_closure(re, re->nfa_start, line_start, false, re->list, &count);
+        re->start_count[line_start] = count;
+
+        for (U32 i = 0; i < count; ++i) {
+            RegexNfaState *st = &re->nfa[re->list[i]];
+            if (st->op == RegexOp_LineEnd)
+                scan_set_add(&re->first, '\n');
+            if (st->op != RegexOp_Byte) continue;
+            for (U32 b = 0; b < 256; ++b) {
+                if (regex_set_has(st->set, (U8)b))
+                    scan_set_add(&re->first, (U8)b);
+            }
+        }
+    }
+
+    U32 starts[2] = { regex_start(re, &re->anchored, false), regex_start(re, &re->anchored, true) };
+    re->empty = false;
+    for (U32 i = 0; i < 2; ++i)
+        re->empty |= (re->anchored.states[starts[i]].flags & (REGEX_FLAG_MATCH | REGEX_FLAG_MATCH_AT_LINE_END)) != 0;
+    return true;
+}
+
+// The state before reading anything, where a line starts or not.
+U32 regex_start(Regex *re, RegexDfa *dfa, bool line_start) {
+    U32 *start = &dfa->start[line_start];
+    if (*start != REGEX_UNKNOWN) return *start;
+
+    U32 count = 0;
+    re->mark++;
+    regex_closure(re, re->nfa_start, line_start, false, re->list, &count);
+
+    bool flushed;
+    U32 id = regex_dfa_state(re, dfa, re->list, count, line_start, &flushed);
+    *start = id;
+    return id;
+}
+
+// Fills in the transition from `state` on `byte`.
+U32 regex_step(Regex *re, RegexDfa *dfa, U32 state, U8 byte) {
+    RegexDfaState *from = &dfa->states[state];
+    bool line_start = from->flags & REGEX_FLAG_LINE_START;
+    U32 *cur = &dfa->sets[from->set_start];
+    U32 cur_count = from->set_count;
+
+    // a newline ends the line, so states waiting for that go on first
+    if (byte == '\n') {
+        bool waits = false;
+        for (U32 i = 0; i < cur_count; ++i)
+            waits |= re->nfa[cur[i]].op == RegexOp_LineEnd;
+
+        if (waits) {
+            U32 *expanded = re->list;
+            re->mark++;
+            for (U32 i = 0; i < cur_count; ++i) {
+                expanded[i] = cur[i];
+                re->marks[cur[i]] = re->mark;
+            }
+            U32 count = cur_count;
+            for (U32 i = 0; i < cur_count; ++i) {
+                if (re->nfa[cur[i]].op == RegexOp_LineEnd)
+                    regex_closure(re, re->nfa[cur[i]].out, line_start, true, expanded, &count);
+            }
+            cur = expanded;
+            cur_count = count;
+        }
+    }
+
+    U32 *next = re->list + REGEX_MAX_NFA_STATES;
+    U32 next_count = 0;
+    bool next_line_start = byte == '\n';
+    re->mark++;
+    for (U32 i = 0; i < cur_count; ++i) {
+        RegexNfaState *st = &re->nfa[cur[i]];
+        if (st->op == RegexOp_Byte && regex_set_has(st->set, byte))
+            regex_closure(re, st->out, next_line_start, false, next, &next_count);
+    }
+    if (dfa->unanchored)
+        regex_closure(re, re->nfa_start, next_line_start, false, next, &next_count);
+
+    bool flushed;
+    U32 to = regex_dfa_state(re, dfa, next, next_count, next_line_start, &flushed);
+    if (!flushed)
+        dfa->states[state].next[byte] = to;
+    return to;
+}
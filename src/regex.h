@@ -0,0 +1,96 @@
+#ifndef REGEX_H_
+#define REGEX_H_
+
+// A pattern compiled to a Thompson NFA and run as a DFA built lazily from it.
+// A DFA state is a set of NFA states, made the first time a search reaches it,
+// and its transitions are filled in as they are taken, so there is no
+// backtracking and a search is linear in the text.
+//
+// Supported: literals, `.`, [classes], \d \w \s \D \W \S, groups, `|`,
+// `*` `+` `?`, and `^` `$` at line boundaries. `.` and negated classes don't
+// match newlines, so only an explicit \n makes a match span lines.
+
+typedef enum RegexOp {
+    RegexOp_Byte,       // a byte in `set`, then out
+    RegexOp_Split,      // out and out1
+    RegexOp_Empty,      // out
+    RegexOp_LineStart,  // out, at the start of a line
+    RegexOp_LineEnd,    // out, at the end of a line
+    RegexOp_Match,
+} RegexOp;
+
+typedef struct RegexNfaState {
+    U64 set[4];
+    U32 out;
+    U32 out1;
+    U32 op;
+} RegexNfaState;
+
+#define REGEX_UNKNOWN 0xFFFFFFFFu
+#define REGEX_DEAD 0u
+
+#define REGEX_FLAG_MATCH 1u             // a match ends here
+#define REGEX_FLAG_MATCH_AT_LINE_END 2u // a match ends here if a line does
+#define REGEX_FLAG_LINE_START 4u        // entered at the start of a line
+#define REGEX_FLAG_IDLE 8u              // unanchored, and no match is under way
+
+typedef struct RegexDfaState {
+    U32 next[256]; // REGEX_UNKNOWN until taken
+    U32 set_start;
+    U32 set_count;
+    U32 hash;
+    U32 flags;
+} RegexDfaState;
+
+// The cache of DFA states. When it fills up it is flushed and built again.
+// `unanchored` DFAs restart the NFA at every byte, finding where matches end.
+typedef struct RegexDfa {
+    RegexDfaState *states;
+    U32 state_count;
+    U32 *sets;
+    U32 set_length;
+    U32 *table;
+    U32 start[2];
+    bool unanchored;
+} RegexDfa;
+
+typedef struct Regex {
+    RegexNfaState *nfa;
+    U32 nfa_count;
+    U32 nfa_start;
+    U32 start_count[2]; // states the start reaches, without and with a line start
+    bool empty;         // the empty string can match
+
+    // closure scratch
+    U32 *stack;
+    U32 *list;
+    U32 *marks;
+    U32 mark;
+
+    RegexDfa anchored;
+    RegexDfa unanchored;
+
+    // every match starts with these bytes, or one of `first`
+    U8 *prefix;
+    U32 prefix_length;
+    ScanSet first;
+} Regex;
+
+Regex regex_create(Arena *arena);
+bool  regex_compile(Regex *re, const U8 *pattern, U64 length);
+U32   regex_start(Regex *re, RegexDfa *dfa, bool line_start);
+U32   regex_step(Regex *re, RegexDfa *dfa, U32 state, U8 byte);
+
+static inline U32 regex_next(Regex *re, RegexDfa *dfa, U32 state, U8 byte) {
+    U32 next = dfa->states[state].next[byte];
+    return next != REGEX_UNKNOWN ? next : regex_step(re, dfa, state, byte);
+}
+
+// `next_byte` is the byte after the position, or -1 at the end of the text
+static inline bool regex_accepts(RegexDfa *dfa, U32 state, I32 next_byte) {
+    U32 flags = dfa->states[state].flags;
+    if (flags & REGEX_FLAG_MATCH) return true;
+    return (flags & REGEX_FLAG_MATCH_AT_LINE_END) && (next_byte == '\n' || next_byte < 0);
+}
+
+#endif
@@ -0,0 +1,282 @@
+// SCANNING ##################################################################
+//
+// Kernels for finding bytes in a buffer 32 at a time. AVX2 is picked at
+// runtime, with SSE2 for newlines and substrings and scalar code otherwise.
+// Callers only drop to byte at a time code at the bytes these return.
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+static inline bool scan_avx2(void) {
+#if SCAN_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+void scan_set_add(ScanSet *set, U8 byte) {
+    set->bits[byte >> 6] |= 1ull << (byte & 63);
+    U8 row = (U8)(1u << ((byte >> 4) & 7));
+    if (byte < 128)
+        set->lo[byte & 15] |= row;
+    else
+        set->lo_high[byte & 15] |= row;
+}
+
+static U64 scan_find_scalar(const ScanSet *set, const U8 *ptr, U64 length) {
+    for (U64 i = 0; i < length; ++i) {
+        if (scan_set_has(set, ptr[i]))
+            return i;
+    }
+    return length;
+}
+
+static U64 scan_count_newlines_scalar(const U8 *ptr, U64 length) {
+    U64 count = 0;
+    for (U64 i = 0; i < length; ++i)
+        count += ptr[i] == '\n';
+    return count;
+}
+
+static U64 scan_find_newline_scalar(const U8 *ptr, U64 length, U64 n) {
+    for (U64 i = 0; i < length; ++i) {
+        if (ptr[i] == '\n' && --n == 0)
+            return i + 1;
+    }
+    return length;
+}
+
+static U64 scan_find_string_scalar(const U8 *ptr, U64 length, const U8 *needle, U64 needle_length) {
+    if (needle_length > length) return length;
+    U64 last = length - needle_length;
+    for (U64 i = 0; i <= last;) {
+        const U8 *first = memchr(ptr + i, needle[0], last - i + 1);
+        if (first == NULL) break;
+        i = (U64)(first - ptr);
+        if (memcmp(ptr + i + 1, needle + 1, needle_length - 1) == 0)
+            return i;
+        i++;
+    }
+    return length;
+}
+
+#if SCAN_X86
+
+// returns the offset just past the nth set bit, n starts at 1
+static inline U64 scan_nth_bit(U32 mask, U64 n) {
+    while (--n)
+        mask &= mask - 1;
+    return (U64)__builtin_ctz(mask) + 1;
+}
+
+__attribute__((target("avx2")))
+static U64 scan_find_avx2(const ScanSet *set, const U8 *ptr, U64 length) {
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo));
+    const __m256i lo_high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo_high));
+    const __m256i row_table = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128
+    );
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    U64 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+
+        // the top bit of each byte picks the table for bytes >= 128
+        __m256i rows = _mm256_blendv_epi8(
+            _mm256_shuffle_epi8(lo_table, lo),
+            _mm256_shuffle_epi8(lo_high_table, lo),
+            v
+        );
+        __m256i hits = _mm256_and_si256(rows, _mm256_shuffle_epi8(row_table, hi));
+        U32 mask = ~(U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hits, zero));
+        if (mask)
+            return i + (U64)__builtin_ctz(mask);
+    }
+
+    return i + scan_find_scalar(set, ptr + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static U64 scan_count_newlines_avx2(const U8 *ptr, U64 length) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+
+    U64 count = 0;
+    U64 i = 0;
+    while (i + 32 <= length) {
+        // each byte lane counts up to 255 matches before being widened
+        U64 blocks = (length - i) / 32;
+        if (blocks > 255) blocks = 255;
+
+        __m256i counts = zero;
+        for (U64 b = 0; b < blocks; ++b, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(v, newline));
+        }
+
+        __m256i sums = _mm256_sad_epu8(counts, zero);
+        count += (U64)_mm256_extract_epi64(sums, 0) + (U64)_mm256_extract_epi64(sums, 1)
+               + (U64)_mm256_extract_epi64(sums, 2) + (U64)_mm256_extract_epi64(sums, 3);
+    }
+
+    return count + scan_count_newlines_scalar(ptr + i, length - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static U64 scan_find_newline_avx2(const U8 *ptr, U64 length, U64 n) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    U64 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        U32 mask = (U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        U64 count = (U64)__builtin_popcount(mask);
+        if (count >= n)
+            return i + scan_nth_bit(mask, n);
+        n -= count;
+    }
+
+    return i + scan_find_newline_scalar(ptr + i, length - i, n);
+}
+
+// Candidates are positions where both the first and last byte of the needle
+// match, which few positions pass for most needles. Only those are compared.
+__attribute__((target("avx2")))
+static U64 scan_find_string_avx2(const U8 *ptr, U64 length, const U8 *needle, U64 needle_length) {
+    const __m256i first = _mm256_set1_epi8((char)needle[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle[needle_length-1]);
+
+    U64 i = 0;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(ptr + i + needle_length - 1));
+        __m256i hits = _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+        U32 mask = (U32)_mm256_movemask_epi8(hits);
+        while (mask) {
+            U64 at = i + (U64)__builtin_ctz(mask);
+            if (memcmp(ptr + at + 1, needle + 1, needle_length - 1) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+
+    return i + scan_find_string_scalar(ptr + i, length - i, needle, needle_length);
+}
+
+static U64 scan_find_string_sse2(const U8 *ptr, U64 length, const U8 *needle, U64 needle_length) {
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[needle_length-1]);
+
+    U64 i = 0;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(ptr + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(ptr + i + needle_length - 1));
+        __m128i hits = _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+        U32 mask = (U32)_mm_movemask_epi8(hits);
+        while (mask) {
+            U64 at = i + (U64)__builtin_ctz(mask);
+            if (memcmp(ptr + at + 1, needle + 1, needle_length - 1) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+
+    return i + scan_find_string_scalar(ptr + i, length - i, needle, needle_length);
+}
+
+static U64 scan_count_newlines_sse2(const U8 *ptr, U64 length) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+
+    U64 count = 0;
+    U64 i = 0;
+    while (i + 16 <= length) {
+        U64 blocks = (length - i) / 16;
+        if (blocks > 255) blocks = 255;
+
+        __m128i counts = zero;
+        for (U64 b = 0; b < blocks; ++b, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(v, newline));
+        }
+
+        __m128i sums = _mm_sad_epu8(counts, zero);
+        count += (U64)_mm_cvtsi128_si64(sums) + (U64)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+    }
+
+    return count + scan_count_newlines_scalar(ptr + i, length - i);
+}
+
+static U64 scan_find_newline_sse2(const U8 *ptr, U64 length, U64 n) {
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    U64 i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+        U32 mask = (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        U64 count = (U64)__builtin_popcount(mask);
+        if (count >= n)
+            return i + scan_nth_bit(mask, n);
+        n -= count;
+    }
+
+    return i + scan_find_newline_scalar(ptr + i, length - i, n);
+}
+
+#endif
+
+// returns the offset of the first byte in the set, or length if there is none
+U64 scan_find(const ScanSet *set, const U8 *ptr, U64 length) {
+#if SCAN_X86
+    if (scan_avx2())
+        return scan_find_avx2(set, ptr, length);
+#endif
+    return scan_find_scalar(set, ptr, length);
+}
+
+U64 scan_count_newlines(const U8 *ptr, U64 length) {
+#if SCAN_X86
+    if (scan_avx2())
+        return scan_count_newlines_avx2(ptr, length);
+    return scan_count_newlines_sse2(ptr, length);
+#else
+    return scan_count_newlines_scalar(ptr, length);
+#endif
+}
+
+// returns the offset just past the nth newline, n starts at 1
+U64 scan_find_newline(const U8 *ptr, U64 length, U64 n) {
+#if SCAN_X86
+    if (scan_avx2())
+        return scan_find_newline_avx2(ptr, length, n);
+    return scan_find_newline_sse2(ptr, length, n);
+#else
+    return scan_find_newline_scalar(ptr, length, n);
+#endif
+}
+
+// returns the offset of the first occurrence of the needle, or length if there is none
+U64 scan_find_string(const U8 *ptr, U64 length, const U8 *needle, U64 needle_length) {
+    if (needle_length == 0) return 0;
+    if (needle_length == 1) {
+        const U8 *found = memchr(ptr, needle[0], length);
+        return found ? (U64)(found - ptr) : length;
+    }
+#if SCAN_X86
+    if (scan_avx2())
+        return scan_find_string_avx2(ptr, length, needle, needle_length);
+    return scan_find_string_sse2(ptr, length, needle, needle_length);
+#else
+    return scan_find_string_scalar(ptr, length, needle, needle_length);
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+// A set of bytes to search for.
+// `lo` and `lo_high` are nibble lookup tables for pshufb: byte b is in the set
+// if bit (b >> 4) & 7 of lo[b & 15] is set, using lo_high when b >= 128.
+typedef struct ScanSet {
+    U64 bits[4];
+    U8 lo[16];
+    U8 lo_high[16];
+} ScanSet;
+
+void        scan_set_add(ScanSet *set, U8 byte);
+U64         scan_find(const ScanSet *set, const U8 *ptr, U64 length);
+U64         scan_count_newlines(const U8 *ptr, U64 length);
+U64         scan_find_newline(const U8 *ptr, U64 length, U64 n);
+U64         scan_find_string(const U8 *ptr, U64 length, const U8 *needle, U64 needle_length);
+
+static inline bool scan_set_has(const ScanSet *set, U8 byte) {
+    return (set->bits[byte >> 6] >> (byte & 63)) & 1;
+}
+
+#endif
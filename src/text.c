@@ -0,0 +1,498 @@
+// PIECE TREE ################################################################
+//
+// The text is a sequence of pieces pointing into the original file buffer or
+// the append only add buffer. Pieces are kept in a treap ordered by position,
+// so edits split and merge O(log n) nodes instead of moving the text around.
+//
+// Every node also sums the newlines in its subtree, which makes the tree the
+// line index. An edit only recounts the pieces it cuts, and lines before and
+// after it are found by descending the tree. Pieces are at most
+// TEXT_PIECE_MAX_LENGTH long, so the scan inside a single piece stays short.
+//
+// This is a sampled index: each piece is a sample holding its byte and
+// newline counts, and the SIMD newline scan selects within it. A 56 byte node
+// per 16KB piece costs under 0.03 bits per byte of text, far below a newline
+// bitmap, and lookups are O(log n) plus one piece scan.
+
+static U32 text_random(Text *t) {
+    // xorshift32
+    U32 x = t->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t->seed = x;
+    return x;
+}
+
+static inline U64 piece_subtree_length(Piece *p) {
+    return p ? p->subtree_length : 0;
+}
+
+static inline U64 piece_subtree_newlines(Piece *p) {
+    return p ? p->subtree_newlines : 0;
+}
+
+static inline void piece_update(Piece *p) {
+    p->subtree_length = piece_subtree_length(p->left) + p->length + piece_subtree_length(p->right);
+    p->subtree_newlines = piece_subtree_newlines(p->left) + p->newlines + piece_subtree_newlines(p->right);
+}
+
+static Piece *piece_create(Text *t, U8 *ptr, U64 length, U64 newlines, U32 priority) {
+    Piece *p = t->free;
+    if (p) {
+        t->free = p->left;
+    } else {
+        expect(t->piece_count < TEXT_MAX_PIECE_COUNT);
+        p = &t->pieces[t->piece_count++];
+    }
+
+    *p = (Piece) {
+        .ptr = ptr,
+        .length = (U32)length,
+        .newlines = (U32)newlines,
+        .subtree_length = length,
+        .subtree_newlines = newlines,
+        .priority = priority,
+    };
+    return p;
+}
+
+// frees the entire subtree
+static void piece_destroy(Text *t, Piece *p) {
+    if (p == NULL) return;
+    piece_destroy(t, p->left);
+    piece_destroy(t, p->right);
+    p->left = t->free;
+    t->free = p;
+}
+
+// Splits the tree into the first `at` bytes and the rest.
+// The piece containing `at` is cut in two if needed.
+static void piece_split(Text *t, Piece *p, U64 at, Piece **left, Piece **right) {
+    if (p == NULL) {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    U64 left_length = piece_subtree_length(p->left);
+    if (at <= left_length) {
+        piece_split(t, p->left, at, left, &p->left);
+        piece_update(p);
+        *right = p;
+    } else if (at >= left_length + p->length) {
+        piece_split(t, p->right, at - left_length - p->length, &p->right, right);
+        piece_update(p);
+        *left = p;
+    } else {
+        // The tail takes over the right subtree. It shares our priority,
+        // which is at least that of every node below us, so the heap holds.
+        U64 offset = at - left_length;
+        U64 tail_length = p->length - offset;
+
+        // only count the shorter half
+        U64 tail_newlines;
+        if (offset < tail_length)
+            tail_newlines = p->newlines - scan_count_newlines(p->ptr, offset);
+        else
+            tail_newlines = scan_count_newlines(p->ptr + offset, tail_length);
+
+        Piece *tail = piece_create(t, p->ptr + offset, tail_length, tail_newlines, p->priority);
+        tail->right = p->right;
+        piece_update(tail);
+
+        p->length = (U32)offset;
+        p->newlines -= (U32)tail_newlines;
+        p->right = NULL;
+        piece_update(p);
+
+        *left = p;
+        *right = tail;
+    }
+}
+
+static Piece *piece_merge(Piece *a, Piece *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->priority > b->priority) {
+        a->right = piece_merge(a->right, b);
+        piece_update(a);
+        return a;
+    } else {
+        b->left = piece_merge(a, b->left);
+        piece_update(b);
+        return b;
+    }
+}
+
+// Grows the last piece if it ends exactly at `end`.
+// Typing appends to the add buffer right after the previous keystroke,
+// so this keeps an insert mode session in a single piece.
+static bool piece_extend_last(Piece *p, U8 *end, U64 length, U64 newlines) {
+    if (p == NULL) return false;
+
+    Piece *last = p;
+    while (last->right)
+        last = last->right;
+    if (last->ptr + last->length != end)
+        return false;
+    if (last->length + length > TEXT_PIECE_MAX_LENGTH)
+        return false;
+
+    last->length += (U32)length;
+    last->newlines += (U32)newlines;
+    for (; p; p = p->right) {
+        p->subtree_length += length;
+        p->subtree_newlines += newlines;
+    }
+    return true;
+}
+
+// appends `length` bytes at `ptr` after `p`, cut into pieces of at most TEXT_PIECE_MAX_LENGTH
+static Piece *piece_append(Text *t, Piece *p, U8 *ptr, U64 length) {
+    while (length) {
+        U64 piece_length = length < TEXT_PIECE_MAX_LENGTH ? length : TEXT_PIECE_MAX_LENGTH;
+        U64 newlines = scan_count_newlines(ptr, piece_length);
+        if (!piece_extend_last(p, ptr, piece_length, newlines))
+            p = piece_merge(p, piece_create(t, ptr, piece_length, newlines, text_random(t)));
+        ptr += piece_length;
+        length -= piece_length;
+    }
+    return p;
+}
+
+Text text_create(Arena *arena) { TRACE
+    return (Text) {
+        .pieces = arena_alloc(arena, TEXT_MAX_PIECE_SIZE, page_size()),
+        .add = arena_alloc(arena, TEXT_ADD_MAX_LENGTH, page_size()),
+        .seed = 0x9E3779B9u,
+    };
+}
+
+void text_clear(Text *t) { TRACE
+    if (t->original)
+        munmap(t->original, t->original_mapped);
+    t->original = NULL;
+    t->original_length = 0;
+    t->original_loaded = 0;
+    t->original_mapped = 0;
+    t->version++;
+
+    t->root = NULL;
+    t->free = NULL;
+    t->piece_count = 0;
+    t->add_length = 0;
+    t->length = 0;
+    t->cache = (TextChunk) {0};
+}
+
+const char *text_open_file_err(I64 err) {
+    if (err == -1) return "File does not exist, or you have insufficient permissions";
+    if (err == -2) return "Could not read file size";
+    if (err == -3) return "File is too large";
+    if (err == -4) return "Could not map file";
+    if (err == -5) return "Could not close file";
+    if (err == -6) return "Not a regular file";
+    return "Error message not implemented";
+}
+
+// Maps the file read only and makes it the original buffer, leaving the text
+// empty until text_append_original. Pages are only read in once the text
+// there is used, and edits go to the add buffer.
+// Returns the file size, or an error for text_open_file_err.
+I64 text_open_file(Text *t, const char *filepath) { TRACE
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -2;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        return -6;
+    }
+
+    U64 size = (U64)st.st_size;
+    if (size > TEXT_MAX_LENGTH) {
+        close(fd);
+        return -3;
+    }
+
+    U8 *original = NULL;
+    if (size != 0) {
+        original = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if ((void*)original == MAP_FAILED) {
+            close(fd);
+            return -4;
+        }
+    }
+
+    if (close(fd) != 0) {
+        if (original) munmap(original, size);
+        return -5;
+    }
+
+    text_clear(t);
+    t->original = original;
+    t->original_length = size;
+    t->original_mapped = size;
+    return (I64)size;
+}
+
+// Reserves an original buffer for a stream of unknown length, leaving the
+// text empty. The reader writes into the returned buffer and the text grows
+// as text_append_original is called past its original length.
+// Returns NULL if the buffer could not be mapped.
+U8 *text_open_stream(Text *t) { TRACE
+    U8 *original = mmap(NULL, TEXT_MAX_LENGTH, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ((void*)original == MAP_FAILED)
+        return NULL;
+
+    text_clear(t);
+    t->original = original;
+    t->original_mapped = TEXT_MAX_LENGTH;
+    return original;
+}
+
+// Appends the original buffer up to `end` to the end of the text.
+// Pieces are cut at TEXT_PIECE_MAX_LENGTH slices of the original, and
+// `slice_newlines` may hold the newline count of each whole slice.
+// A stream's original length grows to `end`.
+void text_append_original(Text *t, U64 end, const U16 *slice_newlines) { TRACE
+    expect(t->original_loaded <= end && end <= t->original_mapped);
+    if (end > t->original_length)
+        t->original_length = end;
+    t->version++;
+
+    Piece *root = t->root;
+    for (U64 at = t->original_loaded; at < end;) {
+        U64 slice = at / TEXT_PIECE_MAX_LENGTH;
+        U64 slice_end = (slice + 1) * TEXT_PIECE_MAX_LENGTH;
+        if (slice_end > end) slice_end = end;
+        U64 length = slice_end - at;
+
+        U64 newlines;
+        if (slice_newlines && length == TEXT_PIECE_MAX_LENGTH)
+            newlines = slice_newlines[slice];
+        else
+            newlines = scan_count_newlines(t->original + at, length);
+
+        U8 *ptr = t->original + at;
+        if (!piece_extend_last(root, ptr, length, newlines))
+            root = piece_merge(root, piece_create(t, ptr, length, newlines, text_random(t)));
+        at = slice_end;
+    }
+
+    t->root = root;
+    t->length += (I64)(end - t->original_loaded);
+    t->original_loaded = end;
+    t->cache = (TextChunk) {0};
+}
+
+void text_insert(Text *t, I64 at, const U8 *str, I64 length) { TRACE
+    expect(0 <= at && at <= t->length);
+    expect(length >= 0);
+    if (length == 0) return;
+    expect(t->add_length + (U64)length <= TEXT_ADD_MAX_LENGTH);
+    t->version++;
+
+    U8 *dst = t->add + t->add_length;
+    memcpy(dst, str, (U64)length);
+    t->add_length += (U64)length;
+
+    Piece *left, *right;
+    piece_split(t, t->root, (U64)at, &left, &right);
+    left = piece_append(t, left, dst, (U64)length);
+    t->root = piece_merge(left, right);
+
+    t->length += length;
+    t->cache = (TextChunk) {0};
+}
+
+void text_remove(Text *t, I64 start, I64 end) { TRACE
+    expect(0 <= start && start <= end && end <= t->length);
+    if (start == end) return;
+    t->version++;
+
+    Piece *left, *middle, *right;
+    piece_split(t, t->root, (U64)start, &left, &middle);
+    piece_split(t, middle, (U64)(end - start), &middle, &right);
+    piece_destroy(t, middle);
+    t->root = piece_merge(left, right);
+
+    t->length -= end - start;
+    t->cache = (TextChunk) {0};
+}
+
+TextChunk text_chunk(Text *t, I64 byte) {
+    TextChunk cache = t->cache;
+    if (cache.start <= byte && byte < cache.start + cache.length)
+        return cache;
+
+    if (byte < 0 || byte >= t->length)
+        return (TextChunk) { .start = byte };
+
+    U64 offset = (U64)byte;
+    Piece *p = t->root;
+    while (1) {
+        U64 left_length = piece_subtree_length(p->left);
+        if (offset < left_length) {
+            p = p->left;
+        } else if (offset < left_length + p->length) {
+            offset -= left_length;
+            break;
+        } else {
+            offset -= left_length + p->length;
+            p = p->right;
+        }
+    }
+
+    TextChunk chunk = {
+        .ptr = p->ptr,
+        .start = byte - (I64)offset,
+        .length = (I64)p->length,
+    };
+    t->cache = chunk;
+    return chunk;
+}
+
+void text_copy(Text *t, U8 *dst, I64 start, I64 end) { TRACE
+    I64 i = start;
+    while (i < end) {
+        TextChunk chunk = text_chunk(t, i);
+        expect(chunk.length != 0);
+
+        I64 chunk_end = chunk.start + chunk.length;
+        if (chunk_end > end) chunk_end = end;
+
+        memcpy(dst, chunk.ptr + (i - chunk.start), (U64)(chunk_end - i));
+        dst += chunk_end - i;
+        i = chunk_end;
+    }
+}
+
+static U64 piece_snapshot(Piece *p, TextChunk *spans, U64 count) {
+    if (p == NULL) return count;
+    count = piece_snapshot(p->left, spans, count);
+
+    // pieces split from one another are often still next to each other
+    TextChunk *last = count ? &spans[count-1] : NULL;
+    if (last && last->ptr + last->length == p->ptr) {
+        last->length += p->length;
+    } else {
+        I64 start = last ? last->start + last->length : 0;
+        spans[count++] = (TextChunk) { .ptr = p->ptr, .start = start, .length = p->length };
+    }
+
+    return piece_snapshot(p->right, spans, count);
+}
+
+// Fills `spans` with the runs of bytes making up the text, followed by the
+// part of the original buffer not appended yet. Neither buffer is written
+// behind the text, so the spans keep the text as it is now through any later
+// edits, until the text is cleared.
+// `spans` needs room for piece_count + 1 spans. Returns how many it took.
+U64 text_snapshot(Text *t, TextChunk *spans) { TRACE
+    U64 count = piece_snapshot(t->root, spans, 0);
+    if (text_loading(t)) {
+        spans[count++] = (TextChunk) {
+            .ptr = t->original + t->original_loaded,
+            .start = t->length,
+            .length = (I64)(t->original_length - t->original_loaded),
+        };
+    }
+    return count;
+}
+
+// returns how many bytes at the start of the text are the same as `bytes`
+I64 text_match_prefix(Text *t, const U8 *bytes, I64 length) { TRACE
+    I64 at = 0;
+    for (TextChunk chunk = text_chunk(t, 0); chunk.length && at < length; chunk = text_chunk_next(t, chunk)) {
+        I64 n = chunk.length < length - at ? chunk.length : length - at;
+        if (memcmp(chunk.ptr, bytes + at, (U64)n) != 0) {
+            I64 i = 0;
+            while (chunk.ptr[i] == bytes[at + i]) i++;
+            return at + i;
+        }
+        at += n;
+    }
+    return at;
+}
+
+// returns how many bytes at the end of the text are the same as the end of
+// `bytes`, up to `max`
+I64 text_match_suffix(Text *t, const U8 *bytes, I64 length, I64 max) { TRACE
+    I64 matched = 0;
+    while (matched < max) {
+        TextChunk chunk = text_chunk(t, t->length - matched - 1);
+        I64 chunk_end = t->length - matched;
+        I64 n = chunk_end - chunk.start;
+        if (n > max - matched) n = max - matched;
+
+        const U8 *text_end = chunk.ptr + (chunk_end - chunk.start);
+        const U8 *bytes_end = bytes + (length - matched);
+        if (memcmp(text_end - n, bytes_end - n, (U64)n) != 0) {
+            I64 i = 0;
+            while (text_end[-i-1] == bytes_end[-i-1]) i++;
+            return matched + i;
+        }
+        matched += n;
+    }
+    return matched;
+}
+
+// returns the number of newlines before `byte`
+I64 text_line_index(Text *t, I64 byte) { TRACE
+    if (byte <= 0) return 0;
+    if (byte >= t->length) return (I64)piece_subtree_newlines(t->root);
+
+    U64 offset = (U64)byte;
+    U64 newlines = 0;
+    Piece *p = t->root;
+    while (1) {
+        U64 left_length = piece_subtree_length(p->left);
+        if (offset < left_length) {
+            p = p->left;
+        } else if (offset < left_length + p->length) {
+            offset -= left_length;
+            newlines += piece_subtree_newlines(p->left);
+            break;
+        } else {
+            offset -= left_length + p->length;
+            newlines += piece_subtree_newlines(p->left) + p->newlines;
+            p = p->right;
+        }
+    }
+
+    return (I64)(newlines + scan_count_newlines(p->ptr, offset));
+}
+
+// returns the byte just past newline number `line`, or the text length if there are not enough lines
+I64 text_line_start(Text *t, I64 line) { TRACE
+    if (line <= 0) return 0;
+    if ((U64)line > piece_subtree_newlines(t->root)) return t->length;
+
+    U64 n = (U64)line;
+    U64 start = 0;
+    Piece *p = t->root;
+    while (1) {
+        U64 left_newlines = piece_subtree_newlines(p->left);
+        if (n <= left_newlines) {
+            p = p->left;
+        } else if (n <= left_newlines + p->newlines) {
+            n -= left_newlines;
+            start += piece_subtree_length(p->left);
+            break;
+        } else {
+            n -= left_newlines + p->newlines;
+            start += piece_subtree_length(p->left) + p->length;
+            p = p->right;
+        }
+    }
+
+    return (I64)(start + scan_find_newline(p->ptr, p->length, n));
+}
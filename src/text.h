@@ -0,0 +1,94 @@
+#ifndef TEXT_H_
+#define TEXT_H_
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A piece of text, stored as a node in the piece tree.
+// Points into either the original file buffer or the add buffer.
+typedef struct Piece {
+    struct Piece *left;
+    struct Piece *right;
+    U8 *ptr;
+    U64 subtree_length;
+    U64 subtree_newlines;
+
+    // at most TEXT_PIECE_MAX_LENGTH, so these fit in 32 bits
+    U32 length;
+    U32 newlines;
+    U32 priority;
+} Piece;
+
+// A contiguous run of text, starting at byte `start`.
+// A chunk of length 0 is returned past the end of the text.
+typedef struct TextChunk {
+    U8 *ptr;
+    I64 start;
+    I64 length;
+} TextChunk;
+
+typedef struct Text {
+    Piece *root;
+    Piece *pieces;
+    Piece *free;
+    U64 piece_count;
+
+    // read only mapping of the opened file, or a buffer a stream is read into,
+    // the first `original_loaded` bytes have been appended to the text
+    U8 *original;
+    U64 original_length;
+    U64 original_loaded;
+    U64 original_mapped;
+
+    // append only
+    U8 *add;
+    U64 add_length;
+
+    I64 length;
+    U32 seed;
+
+    // changes with every edit, so results derived from the text can be kept
+    U64 version;
+
+    // last chunk found, most lookups land in the same chunk
+    TextChunk cache;
+} Text;
+
+Text        text_create(Arena *arena);
+void        text_clear(Text *t);
+I64         text_open_file(Text *t, const char *filepath);
+const char *text_open_file_err(I64 err);
+U8         *text_open_stream(Text *t);
+void        text_append_original(Text *t, U64 end, const U16 *slice_newlines);
+void        text_insert(Text *t, I64 at, const U8 *str, I64 length);
+void        text_remove(Text *t, I64 start, I64 end);
+TextChunk   text_chunk(Text *t, I64 byte);
+void        text_copy(Text *t, U8 *dst, I64 start, I64 end);
+U64         text_snapshot(Text *t, TextChunk *spans);
+I64         text_match_prefix(Text *t, const U8 *bytes, I64 length);
+I64         text_match_suffix(Text *t, const U8 *bytes, I64 length, I64 max);
+I64         text_line_index(Text *t, I64 byte);
+I64         text_line_start(Text *t, I64 line);
+
+// number of lines, counting the empty line after the final newline
+static inline I64 text_line_count(Text *t) {
+    return (I64)(t->root ? t->root->subtree_newlines : 0) + 1;
+}
+
+// true until the whole original buffer has been appended
+static inline bool text_loading(Text *t) {
+    return t->original_loaded < t->original_length;
+}
+
+static inline TextChunk text_chunk_next(Text *t, TextChunk chunk) {
+    return text_chunk(t, chunk.start + chunk.length);
+}
+
+// byte must be in bounds
+static inline U8 text_byte(Text *t, I64 byte) {
+    TextChunk chunk = text_chunk(t, byte);
+    return chunk.ptr[byte - chunk.start];
+}
+
+#endif
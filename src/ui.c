@@ -453,10 +453,11 @@ F32 ui_push_string_terminated(
     y += font_height_px[font_size] + font_atlas->descent[font_size];
     F32 width = 0.f;
     while (1) {
-        U8 ch = *str;
-        if (ch == 0) break;
+        if (*str == 0) break;
 
-        U32 glyph_idx = glyph_lookup_idx(font_size, ch);
+        U32 codepoint;
+        U32 length = utf8_decode(str, 4, &codepoint);
+        U32 glyph_idx = glyph_lookup_codepoint_idx(font_size, codepoint);
         GlyphInfo info = font_atlas->glyph_info[glyph_idx];
 
         if (x + width + info.advance_width <= max_x) {
@@ -469,7 +470,7 @@ F32 ui_push_string_terminated(
         }
         width += info.advance_width;
 
-        str++;
+        str += length;
     }
     return width;
 }
@@ -483,10 +484,11 @@ F32 ui_push_string(
 ) { TRACE
     y += font_height_px[font_size] + font_atlas->descent[font_size];
     F32 width = 0.f;
-    for (U64 i = 0; i < length; ++i) {
-        U8 c = str[i];
-        if (c == '\n') break; 
-        U32 glyph_idx = glyph_lookup_idx(font_size, c);
+    for (U64 i = 0; i < length;) {
+        if (str[i] == '\n') break; 
+        U32 codepoint;
+        i += utf8_decode(str + i, length - i, &codepoint);
+        U32 glyph_idx = glyph_lookup_codepoint_idx(font_size, codepoint);
         GlyphInfo info = font_atlas->glyph_info[glyph_idx];
 
         if (x + width + info.advance_width <= max_x) {
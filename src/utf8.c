@@ -0,0 +1,240 @@
+// UTF-8 ####################################################################
+//
+// Validation skips runs of ASCII 32 bytes at a time, and checks the rest with
+// the lookup tables of Keiser and Lemire: three nibble lookups on each byte
+// and the one before it give the errors a pair can have, and the two and
+// three bytes before say where a continuation byte is owed. AVX2 is picked at
+// runtime, as in scan.c, with scalar code otherwise and for the tail.
+
+static U64 utf8_ascii_length_scalar(const U8 *ptr, U64 length) {
+    for (U64 i = 0; i < length; ++i) {
+        if (ptr[i] >= 0x80)
+            return i;
+    }
+    return length;
+}
+
+static U64 utf8_validate_scalar(const U8 *ptr, U64 length) {
+    for (U64 i = 0; i < length;) {
+        if (ptr[i] < 0x80) {
+            i++;
+            continue;
+        }
+        U32 n = utf8_sequence(ptr + i, length - i);
+        if (n == 0) return i;
+        i += n;
+    }
+    return length;
+}
+
+// Scalar from byte `at`, or from the start of the sequence before it, which
+// may run into it. Everything before is known to be valid.
+static U64 utf8_validate_from(const U8 *ptr, U64 length, U64 at) {
+    U64 from = at;
+    for (U64 back = 1; back <= 3 && back <= at; ++back) {
+        if (!utf8_continuation(ptr[at-back])) {
+            if (ptr[at-back] >= 0xC0) from = at - back;
+            break;
+        }
+    }
+    return from + utf8_validate_scalar(ptr + from, length - from);
+}
+
+#if SCAN_X86
+
+#define UTF8_TOO_SHORT      (1 << 0)
+#define UTF8_TOO_LONG       (1 << 1)
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      ((char)(1 << 7))
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// the 16 bytes of a table, repeated in both lanes
+#define UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_prev(__m256i input, __m256i prev_input, int n) {
+    __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n) {
+        case 1: return _mm256_alignr_epi8(input, shifted, 15);
+        case 2: return _mm256_alignr_epi8(input, shifted, 14);
+        default: return _mm256_alignr_epi8(input, shifted, 13);
+    }
+}
+
+// returns a non zero byte where `input` has an error, given the block before
+__attribute__((target("avx2")))
+static inline __m256i utf8_block_errors(__m256i input, __m256i prev_input) {
+    const __m256i byte_1_high = UTF8_TABLE(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+    );
+    const __m256i byte_1_low = UTF8_TABLE(
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+    );
+    const __m256i byte_2_high = UTF8_TABLE(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+    );
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i prev1 = utf8_prev(input, prev_input, 1);
+    __m256i prev1_high = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+    __m256i prev1_low = _mm256_and_si256(prev1, nibble);
+    __m256i input_high = _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, prev1_high), _mm256_shuffle_epi8(byte_1_low, prev1_low)),
+        _mm256_shuffle_epi8(byte_2_high, input_high)
+    );
+
+    // a third or fourth byte of a sequence, which TWO_CONTS says is owed
+    __m256i prev2 = utf8_prev(input, prev_input, 2);
+    __m256i prev3 = utf8_prev(input, prev_input, 3);
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i owed = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(owed, special);
+}
+
+__attribute__((target("avx2")))
+static U64 utf8_ascii_length_avx2(const U8 *ptr, U64 length) {
+    U64 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        U32 mask = (U32)_mm256_movemask_epi8(v);
+        if (mask)
+            return i + (U64)__builtin_ctz(mask);
+    }
+    return i + utf8_ascii_length_scalar(ptr + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static U64 utf8_validate_avx2(const U8 *ptr, U64 length) {
+    // a lead byte in the last three that the block can't finish
+    const __m256i incomplete_max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+    );
+
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    U64 i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        __m256i errors;
+        if (_mm256_movemask_epi8(input) == 0) {
+            errors = prev_incomplete;
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            errors = utf8_block_errors(input, prev_input);
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+        }
+        if (!_mm256_testz_si256(errors, errors))
+            return utf8_validate_from(ptr, length, i);
+        prev_input = input;
+    }
+
+    // the tail, and any sequence the last block left open
+    return utf8_validate_from(ptr, length, i);
+}
+
+#endif
+
+// returns the length of the leading run of ASCII bytes
+U64 utf8_ascii_length(const U8 *ptr, U64 length) {
+#if SCAN_X86
+    if (scan_avx2())
+        return utf8_ascii_length_avx2(ptr, length);
+#endif
+    return utf8_ascii_length_scalar(ptr, length);
+}
+
+// returns the offset of the first byte not in a valid sequence, or length if there is none
+U64 utf8_validate(const U8 *ptr, U64 length) {
+    U64 ascii = utf8_ascii_length(ptr, length);
+    if (ascii == length) return length;
+#if SCAN_X86
+    if (scan_avx2())
+        return ascii + utf8_validate_avx2(ptr + ascii, length - ascii);
+#endif
+    return ascii + utf8_validate_scalar(ptr + ascii, length - ascii);
+}
+
+// Checks the sequences starting in [start, end) of the `length` bytes at
+// `ptr`. The last may run on past `end`, and one running into `start` from
+// before is left to whoever checks the bytes before, so a buffer can be
+// checked in pieces.
+bool utf8_valid_range(const U8 *ptr, U64 length, U64 start, U64 end) {
+    U64 i = start;
+    for (U64 back = 1; back <= 3 && back <= start; ++back) {
+        if (!utf8_continuation(ptr[start-back])) {
+            U32 n = utf8_sequence(ptr + start - back, length - (start - back));
+            if (n > back) i = start - back + n;
+            break;
+        }
+    }
+    if (i >= end) return true;
+
+    U64 at = i + utf8_validate(ptr + i, end - i);
+    if (at == end) return true;
+    U32 n = utf8_sequence(ptr + at, length - at);
+    return n != 0 && at + n > end;
+}
+
+// writes up to 4 bytes, returning how many
+// invalid codepoints are written as U+FFFD
+U32 utf8_encode(U32 codepoint, U8 *out) {
+    if (codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+        codepoint = UTF8_REPLACEMENT;
+
+    if (codepoint < 0x80) {
+        out[0] = (U8)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (U8)(0xC0 | (codepoint >> 6));
+        out[1] = (U8)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (U8)(0xE0 | (codepoint >> 12));
+        out[1] = (U8)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (U8)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (U8)(0xF0 | (codepoint >> 18));
+    out[1] = (U8)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (U8)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (U8)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
@@ -0,0 +1,63 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+// Text is kept as the bytes of the file, which are read as UTF-8.
+// Bytes that aren't part of a valid sequence stand for themselves, as if
+// Latin-1, so any file can be opened and moved through one byte at a time.
+
+#define UTF8_REPLACEMENT 0xFFFDu
+
+U64  utf8_ascii_length(const U8 *ptr, U64 length);
+U64  utf8_validate(const U8 *ptr, U64 length);
+bool utf8_valid_range(const U8 *ptr, U64 length, U64 start, U64 end);
+U32  utf8_encode(U32 codepoint, U8 *out);
+
+static inline bool utf8_continuation(U8 c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// returns the length of the valid sequence at `ptr`, or 0 if there isn't one
+static inline U32 utf8_sequence(const U8 *ptr, U64 length) {
+    U8 c = ptr[0];
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0;
+    if (c < 0xE0)
+        return length >= 2 && utf8_continuation(ptr[1]) ? 2 : 0;
+
+    // bytes are read in order, so a string can end at any of them
+    if (c < 0xF0) {
+        U8 lo = c == 0xE0 ? 0xA0 : 0x80; // overlong
+        U8 hi = c == 0xED ? 0x9F : 0xBF; // surrogates
+        return length >= 3 && ptr[1] >= lo && ptr[1] <= hi && utf8_continuation(ptr[2]) ? 3 : 0;
+    }
+    if (c < 0xF5) {
+        U8 lo = c == 0xF0 ? 0x90 : 0x80; // overlong
+        U8 hi = c == 0xF4 ? 0x8F : 0xBF; // past U+10FFFF
+        return length >= 4 && ptr[1] >= lo && ptr[1] <= hi
+            && utf8_continuation(ptr[2]) && utf8_continuation(ptr[3]) ? 4 : 0;
+    }
+    return 0;
+}
+
+// returns the length of the codepoint at `ptr`, an invalid byte is one long
+static inline U32 utf8_decode(const U8 *ptr, U64 length, U32 *codepoint) {
+    U32 n = utf8_sequence(ptr, length);
+    switch (n) {
+        case 2: *codepoint = ((U32)(ptr[0] & 0x1F) << 6) | (ptr[1] & 0x3F); return 2;
+        case 3: *codepoint = ((U32)(ptr[0] & 0x0F) << 12) | ((U32)(ptr[1] & 0x3F) << 6) | (ptr[2] & 0x3F); return 3;
+        case 4: *codepoint = ((U32)(ptr[0] & 0x07) << 18) | ((U32)(ptr[1] & 0x3F) << 12)
+                           | ((U32)(ptr[2] & 0x3F) << 6) | (ptr[3] & 0x3F); return 4;
+        default: *codepoint = ptr[0]; return 1;
+    }
+}
+
+// returns the start of the codepoint ending at byte `at`
+static inline U64 utf8_char_before(const U8 *ptr, U64 at) {
+    if (at == 0) return 0;
+    U64 start = at - 1;
+    for (U32 back = 0; back < 3 && start > 0 && utf8_continuation(ptr[start]); ++back)
+        start--;
+    return start + utf8_sequence(ptr + start, at - start) == at ? start : at - 1;
+}
+
+#endif